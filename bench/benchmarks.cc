@@ -0,0 +1,121 @@
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
+#include "flexbuf/flexbuf.h"
+
+using namespace flexbuf;
+
+namespace {
+constexpr size_t VALUES = 1 << 16;
+
+Buffer make_values() {
+  auto buf = Buffer::allocate(VALUES * sizeof(uint32_t));
+  for (size_t i = 0; i < VALUES; ++i)
+    buf.write<uint32_t>(static_cast<uint32_t>(i), i * sizeof(uint32_t));
+  return buf;
+}
+} // namespace
+
+TEST_CASE("Buffer.read<uint32_t>() checked vs unchecked") {
+  auto buf = make_values();
+  BENCHMARK("read") {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < VALUES; ++i)
+      sum += buf.read<uint32_t>(i * sizeof(uint32_t));
+    return sum;
+  };
+  BENCHMARK("read_unchecked") {
+    uint32_t sum = 0;
+    buf.check(0, VALUES * sizeof(uint32_t));
+    for (size_t i = 0; i < VALUES; ++i)
+      sum += buf.read_unchecked<uint32_t>(i * sizeof(uint32_t));
+    return sum;
+  };
+}
+
+TEST_CASE("BufferReader.next<uint32_t>() checked vs unchecked") {
+  auto buf = make_values();
+  BENCHMARK("next") {
+    BufferReader reader{buf};
+    uint32_t sum = 0;
+    for (size_t i = 0; i < VALUES; ++i)
+      sum += reader.next<uint32_t>();
+    return sum;
+  };
+  BENCHMARK("ensure + next_unchecked") {
+    BufferReader reader{buf};
+    uint32_t sum = 0;
+    reader.ensure(VALUES * sizeof(uint32_t));
+    for (size_t i = 0; i < VALUES; ++i)
+      sum += reader.next_unchecked<uint32_t>();
+    return sum;
+  };
+}
+
+TEST_CASE("Buffer.hex()") {
+  auto buf = Buffer::allocate(1500);
+  for (size_t i = 0; i < buf.size(); ++i)
+    buf[i] = static_cast<char>(i);
+  BENCHMARK("hex") {
+    return buf.hex();
+  };
+  std::string reused;
+  BENCHMARK("hex(std::string&)") {
+    reused.clear();
+    return buf.hex(reused).size();
+  };
+  auto hex = buf.hex();
+  BENCHMARK("from_hex") {
+    return Buffer::from_hex(hex);
+  };
+}
+
+TEST_CASE("Buffer.span() atomic vs thread-confined ref count") {
+  auto buf = make_values();
+  BENCHMARK("span Atomic") {
+    size_t size = 0;
+    for (size_t i = 0; i < VALUES; ++i)
+      size += buf.span(i, 1).size();
+    return size;
+  };
+  buf.ref_count_policy(RefCountPolicy::ThreadConfined);
+  BENCHMARK("span ThreadConfined") {
+    size_t size = 0;
+    for (size_t i = 0; i < VALUES; ++i)
+      size += buf.span(i, 1).size();
+    return size;
+  };
+}
+
+TEST_CASE("FlexBuffer vs ChainBuffer append") {
+  auto chunk = Buffer::allocate(4096);
+  constexpr size_t CHUNKS = 4096;
+  BENCHMARK("FlexBuffer <<") {
+    FlexBuffer buf;
+    for (size_t i = 0; i < CHUNKS; ++i)
+      buf << chunk;
+    return buf.size();
+  };
+  BENCHMARK("ChainBuffer <<") {
+    ChainBuffer buf;
+    for (size_t i = 0; i < CHUNKS; ++i)
+      buf << chunk;
+    return buf.size();
+  };
+}
+
+TEST_CASE("FlexBuffer << vs FlexBufferWriter <<") {
+  BENCHMARK("FlexBuffer <<") {
+    FlexBuffer buf;
+    for (size_t i = 0; i < VALUES; ++i)
+      buf << static_cast<uint32_t>(i);
+    return buf.size();
+  };
+  BENCHMARK("FlexBufferWriter <<") {
+    FlexBuffer buf;
+    FlexBufferWriter writer{buf};
+    for (size_t i = 0; i < VALUES; ++i)
+      writer << static_cast<uint32_t>(i);
+    return buf.size();
+  };
+}
@@ -1,48 +1,460 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
 #include <compare>
+#include <coroutine>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
-#include <iomanip>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <ostream>
 #include <span>
-#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <system_error>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
 
 namespace flexbuf {
 
-enum class ResizeMode { KeepData, IgnoreData };
+/**
+ * How FlexBuffer::resize treats existing data when the underlying memory moves.
+ * KeepData copies the data, IgnoreData does not need it preserved,
+ * and Uninitialized additionally guarantees fresh memory that is neither copied to nor zeroed, so untouched pages
+ * are not faulted in until first written.
+ */
+enum class ResizeMode { KeepData, IgnoreData, Uninitialized };
+
+/**
+ * How the reference count shared by a buffer and its spans is maintained.
+ * Atomic is safe to share across threads. ThreadConfined avoids locked read-modify-write instructions when taking and
+ * dropping references, and requires that every reference is only ever held by one thread at a time.
+ */
+enum class RefCountPolicy : uint8_t { Atomic, ThreadConfined };
+
+/**
+ * How Buffer::map_file maps a file for writing.
+ * Shared writes through to the file, Private keeps writes in copy-on-write pages that are never written back.
+ */
+enum class MapMode { Shared, Private };
+
+/**
+ * Access pattern hints for mapped memory, passed to madvise.
+ */
+enum class MapAdvice { Normal, Sequential, Random, WillNeed };
+
+/**
+ * Encoding of the length prefix of a frame.
+ * Varint is unsigned LEB128: 7 bits per byte, least significant first, with the high bit set on all but the last byte.
+ */
+enum class LengthPrefix : uint8_t { Uint16BE, Uint16LE, Uint32BE, Uint32LE, Varint };
+
+/**
+ * Options for Buffer::map_file.
+ * populate pre-faults the whole file at map time (MAP_POPULATE), advise_huge_pages hints with madvise(MADV_HUGEPAGE)
+ * that the mapping should use transparent huge pages where the file system supports them, and advice is applied to
+ * the whole mapping.
+ */
+struct MapOptions {
+  bool populate = false;
+  bool advise_huge_pages = false;
+  MapAdvice advice = MapAdvice::Normal;
+};
 class Buffer;
 class FlexBuffer;
 class BufferReader;
 class BufferWriter;
+class FlexBufferWriter;
+class BufferPool;
+class ChainBuffer;
+class IoVecList;
+class IoUring;
+class AsyncBufferReader;
+class FrameDecoder;
+class ReadOnlyBuffer;
+template <typename B>
+class Cow;
+template <size_t N>
+class SmallFlexBuffer;
 
 /**
  * Internal namespace, never exposed via the API.
  * Behavior is undefined and can change any time without warning.
  */
 namespace internal {
+/**
+ * Allocate from the given memory resource, or from the global operator new when the resource is null.
+ */
+inline void* allocate_bytes(std::pmr::memory_resource* resource, size_t size) {
+  return resource ? resource->allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__) : ::operator new(size);
+}
+
+/**
+ * Return memory obtained from allocate_bytes with the same resource and size.
+ */
+inline void deallocate_bytes(std::pmr::memory_resource* resource, void* ptr, size_t size) noexcept {
+  if (resource)
+    resource->deallocate(ptr, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+  else
+    ::operator delete(ptr);
+}
+
+/**
+ * Where the heap memory of a BufferData came from, which decides how it can grow and how it is freed.
+ * Mapped is anonymous memory, File is a mapped file that is never grown or zeroed with madvise.
+ */
+enum class HeapKind : uint8_t { None, Resource, Malloc, Mapped, File, Owner };
+
+/**
+ * Capacity from which heap memory without a memory resource is mapped directly, so it can grow with mremap.
+ */
+inline constexpr size_t mapped_heap_threshold = static_cast<size_t>(1) << 20;
+
+#if defined(__linux__)
+inline size_t page_size() noexcept {
+  static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return size;
+}
+
+inline size_t mapped_length(size_t capacity) noexcept {
+  return (std::max(static_cast<size_t>(1), capacity) + page_size() - 1) & ~(page_size() - 1);
+}
+
+/**
+ * Apply the given advice to the pages covering the given range of mapped memory. Failure is ignored, as for a hint.
+ */
+inline void advise_pages(const char* begin, size_t size, MapAdvice advice) noexcept {
+  static constexpr int flags[] = {MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED};
+  auto first = reinterpret_cast<uintptr_t>(begin) & ~(static_cast<uintptr_t>(page_size()) - 1);
+  auto end = reinterpret_cast<uintptr_t>(begin + size);
+  if (size > 0)
+    madvise(reinterpret_cast<void*>(first), end - first, flags[static_cast<size_t>(advice)]);
+}
+#endif
+
+/**
+ * Free heap memory of the given kind. Owner memory is freed by its BufferData instead.
+ */
+inline void free_heap_memory(HeapKind kind, std::pmr::memory_resource* resource, char* heap, size_t capacity) noexcept {
+  switch (kind) {
+  case HeapKind::Resource:
+    deallocate_bytes(resource, heap, capacity);
+    break;
+  case HeapKind::Malloc:
+    std::free(heap);
+    break;
+  case HeapKind::Mapped:
+  case HeapKind::File:
+#if defined(__linux__)
+    munmap(heap, mapped_length(capacity));
+#endif
+    break;
+  case HeapKind::None:
+  case HeapKind::Owner:
+    break;
+  }
+}
+
 class BufferData {
 private:
-  std::shared_ptr<char[]> _ptr; // optional shared ownership
+  std::atomic<size_t> _references;
+  std::pmr::memory_resource* _resource; // source of this block and any heap memory, null for operator new
+  size_t _block_size;                   // size of the block holding this BufferData and its inline payload
+  std::shared_ptr<char[]> _ptr;         // optional shared ownership
+  char* _heap;                          // owned memory once the inline payload has been outgrown
+  HeapKind _heap_kind;
+  RefCountPolicy _ref_count_policy;
+  uint16_t _pins;                       // operations outside the process holding the address of the data
+  int _fd;                              // file backing growable HeapKind::File memory, or -1
+  void (*_destroy_owner)(void*);        // destroys the adopted object _heap points to, for HeapKind::Owner
   char* _data;
   size_t _capacity;
 
+  template <typename Owner>
+  static void destroy_owner(void* owner) noexcept {
+    static_cast<Owner*>(owner)->~Owner();
+  }
+
+  HeapKind heap_kind_for(size_t capacity) const noexcept {
+    if (_resource)
+      return HeapKind::Resource;
+#if defined(__linux__)
+    if (capacity >= mapped_heap_threshold)
+      return HeapKind::Mapped;
+#else
+    (void)capacity;
+#endif
+    return HeapKind::Malloc;
+  }
+
+  void* allocate_heap(HeapKind kind, size_t capacity) {
+    void* heap = nullptr;
+    switch (kind) {
+    case HeapKind::Resource:
+      return allocate_bytes(_resource, capacity);
+    case HeapKind::Malloc:
+      heap = std::malloc(std::max(static_cast<size_t>(1), capacity));
+      break;
+    case HeapKind::Mapped:
+#if defined(__linux__)
+      heap = mmap(nullptr, mapped_length(capacity), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (heap == MAP_FAILED)
+        heap = nullptr;
+#endif
+      break;
+    case HeapKind::None:
+    case HeapKind::File:
+    case HeapKind::Owner:
+      break;
+    }
+    if (!heap)
+      throw std::bad_alloc{};
+    return heap;
+  }
+
+  void free_heap(char* heap, HeapKind kind, size_t capacity) noexcept {
+    if (kind == HeapKind::Owner)
+      _destroy_owner(heap);
+    else
+      free_heap_memory(kind, _resource, heap, capacity);
+  }
+
+  void check_unpinned() const {
+    if (_pins > 0)
+      throw std::logic_error{"cannot move data pinned by an io_uring operation"};
+  }
+
+  /**
+   * Grow or shrink the heap memory without going through a new block, where the allocator allows it:
+   * realloc for malloc-backed memory and mremap for mapped memory.
+   * Returns false if the memory could not be moved this way.
+   */
+  bool reallocate_heap(ResizeMode mode, size_t new_capacity) noexcept {
+    void* heap = nullptr;
+    if (mode == ResizeMode::Uninitialized && _heap_kind == HeapKind::Mapped) {
+      // drop the faulted-in pages rather than moving them
+      return false;
+    }
+    if (_heap_kind == HeapKind::Malloc) {
+      if (mode == ResizeMode::KeepData) {
+        heap = std::realloc(_heap, std::max(static_cast<size_t>(1), new_capacity));
+      } else if ((heap = std::malloc(std::max(static_cast<size_t>(1), new_capacity)))) {
+        std::free(_heap);
+      }
+    }
+#if defined(__linux__)
+    if (_heap_kind == HeapKind::Mapped) {
+      heap = mremap(_heap, mapped_length(_capacity), mapped_length(new_capacity), MREMAP_MAYMOVE);
+      if (heap == MAP_FAILED)
+        heap = nullptr;
+    }
+#endif
+    if (!heap)
+      return false;
+    _heap = static_cast<char*>(heap);
+    _data = _heap;
+    _capacity = new_capacity;
+    return true;
+  }
+
 public:
-  BufferData() : _ptr{nullptr}, _data{nullptr}, _capacity{0} {};
-  BufferData(size_t capacity) : _ptr{new char[capacity]}, _data{_ptr.get()}, _capacity{capacity} {};
+  BufferData()
+      : _references{1},
+        _resource{nullptr},
+        _block_size{0},
+        _ptr{nullptr},
+        _heap{nullptr},
+        _heap_kind{HeapKind::None},
+        _ref_count_policy{RefCountPolicy::Atomic},
+        _pins{0},
+        _fd{-1},
+        _destroy_owner{nullptr},
+        _data{nullptr},
+        _capacity{0} {};
   BufferData(std::shared_ptr<char[]> data, size_t offset, size_t size)
-      : _ptr{data}, _data{reinterpret_cast<char*>(_ptr.get() + offset)}, _capacity{size} {};
+      : _references{1},
+        _resource{nullptr},
+        _block_size{0},
+        _ptr{data},
+        _heap{nullptr},
+        _heap_kind{HeapKind::None},
+        _ref_count_policy{RefCountPolicy::Atomic},
+        _pins{0},
+        _fd{-1},
+        _destroy_owner{nullptr},
+        _data{reinterpret_cast<char*>(_ptr.get() + offset)},
+        _capacity{size} {};
   BufferData(char* data, size_t offset, size_t size)
-      : _ptr{nullptr}, _data{reinterpret_cast<char*>(data + offset)}, _capacity{size} {};
+      : _references{1},
+        _resource{nullptr},
+        _block_size{0},
+        _ptr{nullptr},
+        _heap{nullptr},
+        _heap_kind{HeapKind::None},
+        _ref_count_policy{RefCountPolicy::Atomic},
+        _pins{0},
+        _fd{-1},
+        _destroy_owner{nullptr},
+        _data{reinterpret_cast<char*>(data + offset)},
+        _capacity{size} {};
   BufferData(const BufferData&) = delete;
   BufferData& operator=(const BufferData&) = delete;
-  BufferData(BufferData&&) = default;
-  BufferData& operator=(BufferData&&) = default;
-  ~BufferData() = default;
+  BufferData(BufferData&&) = delete;
+  BufferData& operator=(BufferData&&) = delete;
+  ~BufferData() {
+    if (_heap)
+      free_heap(_heap, _heap_kind, _capacity);
+#if defined(__linux__)
+    if (_fd >= 0)
+      ::close(_fd);
+#endif
+  }
+
+  /**
+   * Record the block this BufferData was placed into, so release() can return it.
+   */
+  void block(std::pmr::memory_resource* resource, size_t block_size) noexcept {
+    _resource = resource;
+    _block_size = block_size;
+  }
+
+  /**
+   * Take ownership of a file mapping of the given size as the data, unmapping it when this BufferData is released.
+   */
+  void map(char* data, size_t size) noexcept {
+    _heap = data;
+    _heap_kind = HeapKind::File;
+    _data = data;
+    _capacity = size;
+  }
+
+#if defined(__linux__)
+  /**
+   * Take ownership of the given file descriptor, and map the file shared at the given capacity as data that grows
+   * and shrinks with the file. Throws std::system_error, closing the file descriptor, if it cannot be mapped.
+   */
+  void map_file(int fd, size_t capacity) {
+    void* heap = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(capacity)) == 0)
+      heap = mmap(nullptr, mapped_length(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (heap == MAP_FAILED) {
+      auto error = errno;
+      ::close(fd);
+      throw std::system_error{error, std::generic_category()};
+    }
+    map(static_cast<char*>(heap), capacity);
+    _fd = fd;
+  }
+
+  /**
+   * Whether the data is a mapped file that grows and shrinks with the file.
+   */
+  bool file_backed() const noexcept {
+    return _fd >= 0;
+  }
+
+  /**
+   * Resize the backing file and its mapping to the given capacity. Throws std::logic_error if the data is pinned.
+   * The file is resized first, so a failure (e.g. ENOSPC) throws std::system_error with the mapping unchanged.
+   * When growing, a failure to grow the mapping shrinks the file back before throwing.
+   */
+  void resize_file(size_t new_capacity) {
+    check_unpinned();
+    if (ftruncate(_fd, static_cast<off_t>(new_capacity)) != 0)
+      throw std::system_error{errno, std::generic_category()};
+    auto heap = mremap(_heap, mapped_length(_capacity), mapped_length(new_capacity), MREMAP_MAYMOVE);
+    if (heap == MAP_FAILED) {
+      auto error = errno;
+      // best effort, a file left longer than the mapping is harmless
+      if (new_capacity > _capacity)
+        ftruncate(_fd, static_cast<off_t>(_capacity));
+      throw std::system_error{error, std::generic_category()};
+    }
+    _heap = static_cast<char*>(heap);
+    _data = _heap;
+    _capacity = new_capacity;
+  }
+
+  /**
+   * Flush the mapped data to the backing file. Throws std::system_error on failure.
+   */
+  void sync_file() {
+    if (msync(_heap, mapped_length(_capacity), MS_SYNC) != 0)
+      throw std::system_error{errno, std::generic_category()};
+  }
+#endif
+
+  /**
+   * Take ownership of an object placed in this BufferData's inline payload, using its data() as the data.
+   * The object is destroyed when the data moves to new memory or this BufferData is released.
+   */
+  template <typename Owner>
+  void adopt(Owner* owner, size_t capacity) noexcept {
+    _heap = reinterpret_cast<char*>(owner);
+    _heap_kind = HeapKind::Owner;
+    _destroy_owner = &destroy_owner<Owner>;
+    _data = owner->data();
+    _capacity = capacity;
+  }
+
+  /**
+   * Get the adopted object if it is of the given type and still backs the data, otherwise null.
+   */
+  template <typename Owner>
+  Owner* owner() noexcept {
+    return _heap_kind == HeapKind::Owner && _destroy_owner == &destroy_owner<Owner> ? reinterpret_cast<Owner*>(_heap)
+                                                                                    : nullptr;
+  }
+
+  HeapKind heap_kind() const noexcept {
+    return _heap_kind;
+  }
+
+  /**
+   * Give up ownership of the heap memory to the caller, leaving this BufferData empty.
+   */
+  char* release_heap() noexcept {
+    auto heap = _heap;
+    _heap = nullptr;
+    _heap_kind = HeapKind::None;
+    _data = nullptr;
+    _capacity = 0;
+    return heap;
+  }
+
+  /**
+   * Get the memory resource backing this data, or null for the global operator new.
+   */
+  std::pmr::memory_resource* resource() const noexcept {
+    return _resource;
+  }
 
   char* data() {
     return _data;
@@ -56,756 +468,4751 @@ public:
     return _capacity;
   }
 
-  void resize(ResizeMode mode, size_t new_capacity) noexcept {
-    auto old_ptr = _ptr;
+  size_t use_count() const noexcept {
+    return _references.load(std::memory_order_relaxed);
+  }
+
+  RefCountPolicy ref_count_policy() const noexcept {
+    return _ref_count_policy;
+  }
+
+  void ref_count_policy(RefCountPolicy policy) noexcept {
+    _ref_count_policy = policy;
+  }
+
+  /**
+   * Pin the data at its current address while the kernel holds that address, e.g. for an io_uring read, so that
+   * resizing throws std::logic_error rather than freeing memory the kernel may still write into.
+   * Pins nest. Not thread-safe: pin and resize from the same thread.
+   */
+  void pin() noexcept {
+    ++_pins;
+  }
+
+  void unpin() noexcept {
+    --_pins;
+  }
+
+  void retain() noexcept {
+    // a relaxed load and store compile to plain moves, without the lock prefix of fetch_add, while keeping the count
+    // one std::atomic for both policies so a buffer can switch between them
+    if (_ref_count_policy == RefCountPolicy::ThreadConfined) [[unlikely]]
+      _references.store(_references.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    else
+      _references.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Drop a reference, destroying this BufferData and freeing its block when it was the last one.
+   */
+  void release() noexcept {
+    size_t references;
+    if (_ref_count_policy == RefCountPolicy::ThreadConfined) [[unlikely]] {
+      references = _references.load(std::memory_order_relaxed);
+      _references.store(references - 1, std::memory_order_relaxed);
+    } else {
+      references = _references.fetch_sub(1, std::memory_order_acq_rel);
+    }
+    if (references == 1) {
+      auto resource = _resource;
+      auto block_size = _block_size;
+      this->~BufferData();
+      deallocate_bytes(resource, this, block_size);
+    }
+  }
+
+  /**
+   * Fill the given range with 0's.
+   * Whole pages of mapped memory are released back to the kernel instead of being written, so they read as zero
+   * without being faulted in.
+   */
+  void zero(size_t offset, size_t size) noexcept {
+    auto begin = _data + offset;
+#if defined(__linux__)
+    if (_heap_kind == HeapKind::Mapped) {
+      auto mask = ~(static_cast<uintptr_t>(page_size()) - 1);
+      auto first = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(begin) + page_size() - 1) & mask);
+      auto last = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(begin + size) & mask);
+      if (first < last && madvise(first, last - first, MADV_DONTNEED) == 0) {
+        memset(begin, 0, first - begin);
+        memset(last, 0, begin + size - last);
+        return;
+      }
+    }
+#endif
+    memset(begin, 0, size);
+  }
+
+  /**
+   * Move the data to heap memory of the given capacity.
+   * Memory from a memory resource is always moved to a new block from the same resource and copied.
+   * Otherwise small capacities live in malloc-backed memory that grows with realloc, and large capacities in
+   * mapped memory that grows with mremap, so the data is only copied when it moves between the two.
+   * Spans reference this BufferData rather than the memory itself, so they never pin the old address.
+   * An inline payload, e.g. of a fixed-size Buffer, is left behind unused until the BufferData is released.
+   * A file-backed mapping always stays in its file.
+   * Throws std::logic_error if the data is pinned.
+   */
+  void resize(ResizeMode mode, size_t new_capacity) {
+#if defined(__linux__)
+    if (_fd >= 0) {
+      resize_file(new_capacity);
+      return;
+    }
+#endif
+    check_unpinned();
+    auto new_kind = heap_kind_for(new_capacity);
+    if (_heap && new_kind == _heap_kind && new_kind != HeapKind::Resource && reallocate_heap(mode, new_capacity))
+      return;
+    // allocate before touching any state, so a failed allocation leaves the data as it was
+    auto new_heap = static_cast<char*>(allocate_heap(new_kind, new_capacity));
+    auto old_ptr = std::move(_ptr);
+    auto old_heap = _heap;
+    auto old_heap_kind = _heap_kind;
     auto old_data = _data;
-    _ptr = std::shared_ptr<char[]>{new char[new_capacity]};
-    _data = _ptr.get();
+    auto old_capacity = _capacity;
+    _heap = new_heap;
+    _heap_kind = new_kind;
+    _data = _heap;
     if (mode == ResizeMode::KeepData) {
-      memcpy(_data, old_data, std::min(_capacity, new_capacity));
+      memcpy(_data, old_data, std::min(old_capacity, new_capacity));
     }
     _capacity = new_capacity;
+    if (old_heap)
+      free_heap(old_heap, old_heap_kind, old_capacity);
   }
 };
-} // namespace internal
 
 /**
- * A fixed-size buffer that can wrap existing memory or allocate new memory.
- * Pass-by-value semantics will deep copy the underlying data - O(n).
- * The default constructor wraps a nullptr and has a size of 0.
- * Static factory methods are used for differentiating wrap, allocation, and copy semantics.
+ * Size of a BufferData block header, rounded up so that an inline payload following it is aligned like `new char[]`.
  */
-class Buffer {
+inline constexpr size_t buffer_data_header_size =
+    (sizeof(BufferData) + __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) & ~(__STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1);
+
+/**
+ * Intrusive reference to a BufferData, shared by a Buffer and all of its spans.
+ */
+class BufferDataPtr {
 private:
-  friend class FlexBuffer;
+  BufferData* _ptr;
 
-  using BufferData = flexbuf::internal::BufferData;
-  using BufferDataPtr = std::shared_ptr<BufferData>;
-  BufferDataPtr _data;
-  size_t _offset;
-  size_t _size;
+public:
+  BufferDataPtr() noexcept : _ptr{nullptr} {};
+  explicit BufferDataPtr(BufferData* adopt) noexcept : _ptr{adopt} {};
+  BufferDataPtr(const BufferDataPtr& rhs) noexcept : _ptr{rhs._ptr} {
+    if (_ptr)
+      _ptr->retain();
+  }
+  BufferDataPtr& operator=(const BufferDataPtr& rhs) noexcept {
+    BufferDataPtr{rhs}.swap(*this);
+    return *this;
+  }
+  BufferDataPtr(BufferDataPtr&& rhs) noexcept : _ptr{rhs._ptr} {
+    rhs._ptr = nullptr;
+  }
+  BufferDataPtr& operator=(BufferDataPtr&& rhs) noexcept {
+    BufferDataPtr{std::move(rhs)}.swap(*this);
+    return *this;
+  }
+  ~BufferDataPtr() {
+    if (_ptr)
+      _ptr->release();
+  }
 
-  Buffer(BufferDataPtr& data, size_t offset, size_t size) : _data{data}, _offset{offset}, _size{size} {};
-  Buffer(BufferDataPtr&& data, size_t offset, size_t size) : _data{data}, _offset{offset}, _size{size} {};
+  void swap(BufferDataPtr& rhs) noexcept {
+    std::swap(_ptr, rhs._ptr);
+  }
 
-  inline void check_bounds(size_t index, size_t size) const {
-    auto end = index + size;
-    // if "beyond size of this span" or "beyond capacity of underlying data"
-    if (end > _size || end > _data->capacity() - _offset)
-      throw std::range_error{"array index out of bounds"};
+  /**
+   * Give up this reference without dropping it, so the data is never freed.
+   */
+  void leak() noexcept {
+    _ptr = nullptr;
   }
 
-  inline char* raw_data() noexcept {
-    return reinterpret_cast<char*>(_data->data() + _offset);
+  BufferData* get() const noexcept {
+    return _ptr;
   }
 
-  inline const char* raw_data() const noexcept {
-    return reinterpret_cast<char*>(_data->data() + _offset);
+  BufferData* operator->() const noexcept {
+    return _ptr;
   }
 
-public:
-  static const size_t npos = -1;
+  BufferData& operator*() const noexcept {
+    return *_ptr;
+  }
 
-  /**
-   * Wrap the given raw pointer at the given offset/size.
-   * Beware ownership: you must ensure the raw pointer remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
-   */
-  static const Buffer wrap(const char* data, size_t offset, size_t size) {
-    return Buffer{std::make_shared<BufferData>(const_cast<char*>(data), offset, size), 0, size};
+  size_t use_count() const noexcept {
+    return _ptr ? _ptr->use_count() : 0;
   }
+};
 
-  /**
-   * Wrap the given raw pointer at the given offset/size.
-   * Beware ownership: you must ensure the raw pointer remains valid.
-   * Consider wrap(std::shared_ptr<char[]> data, size_t offset, size_t size) for safety if possible.
-   */
-  static Buffer wrap(char* data, size_t offset, size_t size) {
-    return Buffer{std::make_shared<BufferData>(data, offset, size), 0, size};
+/**
+ * Create a BufferData with no inline payload, forwarding the arguments to its constructor.
+ */
+template <typename... Args>
+BufferDataPtr make_buffer_data(Args&&... args) {
+  auto block = ::operator new(buffer_data_header_size);
+  auto data = new (block) BufferData(std::forward<Args>(args)...);
+  data->block(nullptr, buffer_data_header_size);
+  return BufferDataPtr{data};
+}
+
+/**
+ * Allocate a BufferData and its payload of the given capacity in a single contiguous block:
+ * [ BufferData (reference count, header) | payload ]
+ * The block, and any later growth, comes from the given memory resource (null for the global operator new).
+ */
+inline BufferDataPtr allocate_buffer_data(size_t capacity, std::pmr::memory_resource* resource = nullptr) {
+  auto block_size = buffer_data_header_size + capacity;
+  auto block = static_cast<char*>(allocate_bytes(resource, block_size));
+  auto data = new (block) BufferData(block + buffer_data_header_size, 0, capacity);
+  data->block(resource, block_size);
+  return BufferDataPtr{data};
+}
+
+/**
+ * Allocate a BufferData with its payload of the given capacity in separate heap memory, not yet written:
+ * [ BufferData (reference count, header) ] -> [ payload ]
+ * Used for growable data, so that no inline payload is left behind unused once it grows, and the payload can be
+ * handed out on its own. The header, and all payload memory, comes from the given memory resource (null for the
+ * global operator new and the heap).
+ */
+inline BufferDataPtr allocate_heap_buffer_data(size_t capacity, std::pmr::memory_resource* resource = nullptr) {
+  auto block = allocate_bytes(resource, buffer_data_header_size);
+  BufferDataPtr data{new (block) BufferData()};
+  data->block(resource, buffer_data_header_size);
+  data->resize(ResizeMode::Uninitialized, capacity);
+  return data;
+}
+
+/**
+ * Allocate a BufferData that adopts the given container (e.g. std::string or std::vector<char>) as its data,
+ * moving the container into the inline payload so that its storage is neither copied nor separately tracked.
+ */
+template <typename Owner>
+BufferDataPtr adopt_buffer_data(Owner&& owner) {
+  auto data = allocate_buffer_data(sizeof(Owner));
+  auto adopted = new (data->data()) Owner(std::move(owner));
+  data->adopt(adopted, adopted->size());
+  return data;
+}
+
+/**
+ * Arithmetic types that can be converted between byte orders.
+ */
+template <typename T>
+inline constexpr bool is_swappable_v =
+    std::is_arithmetic_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+/**
+ * Reverse the byte order of the given value, compiling to a single bswap/movbe.
+ */
+template <typename T>
+constexpr T byteswap(T value) noexcept {
+  if constexpr (sizeof(T) == 2) {
+    return std::bit_cast<T>(__builtin_bswap16(std::bit_cast<uint16_t>(value)));
+  } else if constexpr (sizeof(T) == 4) {
+    return std::bit_cast<T>(__builtin_bswap32(std::bit_cast<uint32_t>(value)));
+  } else if constexpr (sizeof(T) == 8) {
+    return std::bit_cast<T>(__builtin_bswap64(std::bit_cast<uint64_t>(value)));
+  } else {
+    return value;
   }
+}
 
-  /**
-   * Wrap the given shared_ptr buffer at the given offset/size.
-   */
-  static const Buffer wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) {
-    return Buffer{std::make_shared<BufferData>(std::const_pointer_cast<char[]>(data), offset, size), 0, size};
+/**
+ * Convert between host order and the given byte order. The conversion is its own inverse.
+ */
+template <std::endian Order, typename T>
+constexpr T convert_endian(T value) noexcept {
+  if constexpr (Order == std::endian::native) {
+    return value;
+  } else {
+    return byteswap(value);
   }
+}
 
-  /**
-   * Wrap the given shared_ptr buffer at the given offset/size.
-   */
-  static Buffer wrap(std::shared_ptr<char[]> data, size_t offset, size_t size) {
-    return Buffer{std::make_shared<BufferData>(data, offset, size), 0, size};
+/**
+ * Most bytes in a LEB128 varint of a 64-bit value.
+ */
+inline constexpr size_t max_varint_width = 10;
+
+/**
+ * Width in bytes of a fixed-width length prefix. Varint prefixes vary and report 0.
+ */
+constexpr size_t prefix_width(LengthPrefix format) noexcept {
+  switch (format) {
+  case LengthPrefix::Uint16BE:
+  case LengthPrefix::Uint16LE:
+    return 2;
+  case LengthPrefix::Uint32BE:
+  case LengthPrefix::Uint32LE:
+    return 4;
+  case LengthPrefix::Varint:
+    break;
   }
+  return 0;
+}
 
-  /**
-   * Wrap the given string.
-   * Beware ownership: you must ensure the referenced string remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
-   */
-  static Buffer wrap(const std::string& string) {
-    return wrap(string.data(), 0, string.size());
+/**
+ * Largest length that fits a prefix of the given format, with varints limited to the given width.
+ */
+constexpr uint64_t max_prefix_length(LengthPrefix format, size_t varint_width) noexcept {
+  switch (format) {
+  case LengthPrefix::Uint16BE:
+  case LengthPrefix::Uint16LE:
+    return UINT16_MAX;
+  case LengthPrefix::Uint32BE:
+  case LengthPrefix::Uint32LE:
+    return UINT32_MAX;
+  case LengthPrefix::Varint:
+    break;
   }
+  return varint_width >= 10 ? UINT64_MAX : (static_cast<uint64_t>(1) << (7 * varint_width)) - 1;
+}
 
-  /**
-   * Wrap the given string_view.
-   * Beware ownership: you must ensure the referenced string remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
-   */
-  static const Buffer wrap(const std::string_view& string) {
-    return wrap(string.data(), 0, string.size());
+/**
+ * Encode the given value as a LEB128 varint of exactly the given width, padding with continuation bytes as needed.
+ * The value must fit in 7 * width bits.
+ */
+inline void encode_varint(char* dest, uint64_t value, size_t width) noexcept {
+  for (size_t i = 0; i + 1 < width; ++i) {
+    dest[i] = static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
   }
+  dest[width - 1] = static_cast<char>(value & 0x7f);
+}
 
-  /**
-   * Wrap the given span.
-   * Beware ownership: you must ensure the span's underlying data remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
-   */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static const Buffer wrap(const std::span<const T>& span) {
-    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
-    auto size = span.size() * sizeof(T);
-    return Buffer{std::make_shared<BufferData>(data, 0, size), 0, size};
+/**
+ * Decode a LEB128 varint from at most the given number of bytes, returning its width, or 0 if it is incomplete.
+ * Throws std::runtime_error if it runs longer than, or holds more bits than, any 64-bit value.
+ */
+inline size_t decode_varint(const char* src, size_t size, uint64_t& value) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < size && i < max_varint_width; ++i) {
+    auto byte = static_cast<uint8_t>(src[i]);
+    // the last byte holds only bit 63, and must not continue
+    if (i == max_varint_width - 1 && byte > 1)
+      throw std::runtime_error{"malformed varint"};
+    result |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      value = result;
+      return i + 1;
+    }
+  }
+  if (size >= max_varint_width)
+    throw std::runtime_error{"malformed varint"};
+  return 0;
+}
+
+#if defined(__SSE2__)
+/**
+ * Reverse the bytes of every T-sized lane of the given vector.
+ */
+template <size_t Size>
+inline __m128i byteswap_lanes(__m128i v) noexcept {
+  if constexpr (Size == 4) {
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+  } else if constexpr (Size == 8) {
+    v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+  }
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+#endif
+
+#if defined(__AVX2__)
+template <size_t Size>
+inline __m256i byteswap_lanes(__m256i v) noexcept {
+  // shuffle indices reversing every Size-byte group within each 128-bit half
+  static constexpr auto mask = [] {
+    std::array<char, 32> mask{};
+    for (size_t j = 0; j < mask.size(); ++j)
+      mask[j] = static_cast<char>((j % 16) / Size * Size + (Size - 1 - j % Size));
+    return mask;
+  }();
+  return _mm256_shuffle_epi8(v, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask.data())));
+}
+#endif
+
+/**
+ * Copy count values of type T from src to dest, reversing the byte order of each value.
+ * src and dest may be the same memory, but must not otherwise overlap.
+ */
+template <typename T>
+inline void byteswap_copy(char* dest, const char* src, size_t count) noexcept {
+  size_t i = 0;
+  if constexpr (sizeof(T) > 1) {
+#if defined(__AVX2__)
+    for (; i + 32 / sizeof(T) <= count; i += 32 / sizeof(T)) {
+      auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * sizeof(T)));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i * sizeof(T)), byteswap_lanes<sizeof(T)>(v));
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 / sizeof(T) <= count; i += 16 / sizeof(T)) {
+      auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * sizeof(T)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i * sizeof(T)), byteswap_lanes<sizeof(T)>(v));
+    }
+#endif
+  }
+  for (; i < count; ++i) {
+    T value;
+    memcpy(&value, src + i * sizeof(T), sizeof(T));
+    value = byteswap(value);
+    memcpy(dest + i * sizeof(T), &value, sizeof(T));
+  }
+}
+
+/**
+ * Copy count values of type T from src to dest, converting between host order and the given byte order.
+ * Either pointer may be null when count is 0, e.g. for an empty span.
+ */
+template <std::endian Order, typename T>
+inline void convert_endian_copy(char* dest, const char* src, size_t count) noexcept {
+  if (count == 0)
+    return;
+  if constexpr (Order == std::endian::native) {
+    memmove(dest, src, count * sizeof(T));
+  } else {
+    byteswap_copy<T>(dest, src, count);
+  }
+}
+
+#if defined(__SSE2__)
+/**
+ * Convert 16 nibbles (0-15) to lowercase hex digits.
+ */
+inline __m128i hex_digits(__m128i nibbles) noexcept {
+  auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+  return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+/**
+ * Convert 16 hex digits of either case to their values, clearing valid if any of them is not a hex digit.
+ */
+inline __m128i hex_values(__m128i chars, bool& valid) noexcept {
+  auto digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  auto is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  auto letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  auto is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  valid &= _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) == 0xffff;
+  return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                      _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+/**
+ * Combine 16 hex digit values, high nibble first, into 8 bytes held in the low half of each 16-bit lane.
+ */
+inline __m128i hex_pairs(__m128i values) noexcept {
+  auto high = _mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x0f)), 4);
+  return _mm_or_si128(high, _mm_srli_epi16(values, 8));
+}
+#endif
+
+/**
+ * Write the 2 * size lowercase hex digits of the given bytes to dest.
+ */
+inline void hex_encode(char* dest, const char* src, size_t size) noexcept {
+  static constexpr char digits[] = "0123456789abcdef";
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= size; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    auto mask = _mm256_set1_epi8(0x0f);
+    auto high = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+    auto low = _mm256_and_si256(v, mask);
+    auto to_digits = [](__m256i nibbles) {
+      auto letters =
+          _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+      return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+    };
+    high = to_digits(high);
+    low = to_digits(low);
+    // unpack interleaves within each 128-bit half, so reassemble the halves in order
+    auto first = _mm256_unpacklo_epi8(high, low);
+    auto second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= size; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    auto mask = _mm_set1_epi8(0x0f);
+    auto high = hex_digits(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    auto low = hex_digits(_mm_and_si128(v, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+  }
+#endif
+  for (; i < size; ++i) {
+    auto byte = static_cast<unsigned char>(src[i]);
+    dest[2 * i] = digits[byte >> 4];
+    dest[2 * i + 1] = digits[byte & 0x0f];
+  }
+}
+
+/**
+ * Decode 2 * size hex digits of either case from src into size bytes at dest.
+ * Returns false if src contains anything other than hex digits, leaving dest partially written.
+ */
+inline bool hex_decode(char* dest, const char* src, size_t size) noexcept {
+  size_t i = 0;
+#if defined(__SSE2__)
+  bool valid = true;
+  for (; i + 16 <= size; i += 16) {
+    auto first = hex_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i)), valid);
+    auto second = hex_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16)), valid);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packus_epi16(hex_pairs(first), hex_pairs(second)));
+  }
+  if (!valid)
+    return false;
+#endif
+  auto value = [](char c) -> int {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  };
+  for (; i < size; ++i) {
+    auto high = value(src[2 * i]);
+    auto low = value(src[2 * i + 1]);
+    if (high < 0 || low < 0)
+      return false;
+    dest[i] = static_cast<char>((high << 4) | low);
+  }
+  return true;
+}
+} // namespace internal
+
+/**
+ * Frees memory released from a FlexBuffer, however it was allocated.
+ */
+class ReleaseDeleter {
+private:
+  internal::HeapKind _kind;
+  std::pmr::memory_resource* _resource;
+  size_t _capacity;
+
+public:
+  ReleaseDeleter() noexcept : _kind{internal::HeapKind::None}, _resource{nullptr}, _capacity{0} {};
+  ReleaseDeleter(internal::HeapKind kind, std::pmr::memory_resource* resource, size_t capacity) noexcept
+      : _kind{kind}, _resource{resource}, _capacity{capacity} {};
+
+  void operator()(char* data) const noexcept {
+    internal::free_heap_memory(_kind, _resource, data, _capacity);
+  }
+};
+
+/**
+ * Memory released from a FlexBuffer. Memory that came from a std::pmr::memory_resource must not outlive it.
+ */
+using ReleasedPtr = std::unique_ptr<char[], ReleaseDeleter>;
+
+/**
+ * A fixed-size buffer that can wrap existing memory or allocate new memory.
+ * Pass-by-value semantics will deep copy the underlying data - O(n).
+ * The default constructor wraps a nullptr and has a size of 0.
+ * Static factory methods are used for differentiating wrap, allocation, and copy semantics.
+ */
+class Buffer {
+private:
+  friend class FlexBuffer;
+  friend class BufferPool;
+  friend class ChainBuffer;
+  friend class IoVecList;
+  friend class IoUring;
+  friend class AsyncBufferReader;
+  friend class FrameDecoder;
+  friend class FlexBufferWriter;
+  friend class ReadOnlyBuffer;
+  template <typename B>
+  friend class Cow;
+#if defined(__linux__)
+  friend ssize_t read_into(int fd, FlexBuffer& dest, size_t max_size);
+#endif
+
+  using BufferData = flexbuf::internal::BufferData;
+  using BufferDataPtr = flexbuf::internal::BufferDataPtr;
+  BufferDataPtr _data;
+  size_t _offset;
+  size_t _size;
+
+  Buffer(BufferDataPtr& data, size_t offset, size_t size) : _data{data}, _offset{offset}, _size{size} {};
+  Buffer(BufferDataPtr&& data, size_t offset, size_t size) : _data{std::move(data)}, _offset{offset}, _size{size} {};
+
+  inline void check_bounds(size_t index, size_t size) const {
+    // the lesser of "size of this span" and "capacity of underlying data", compared without overflowing index + size,
+    // where a FlexBuffer may have shrunk below the offset of this span
+    auto capacity = _data->capacity();
+    if (_offset > capacity)
+      throw std::range_error{"array index out of bounds"};
+    auto limit = std::min(_size, capacity - _offset);
+    if (index > limit || size > limit - index)
+      throw std::range_error{"array index out of bounds"};
+  }
+
+  inline char* raw_data() noexcept {
+    return reinterpret_cast<char*>(_data->data() + _offset);
+  }
+
+  inline const char* raw_data() const noexcept {
+    return reinterpret_cast<char*>(_data->data() + _offset);
+  }
+
+#if defined(__linux__)
+  static Buffer mmap_file(const std::string& path, int protection, int flags, MapOptions options) {
+    auto fd = ::open(path.c_str(), ((protection & PROT_WRITE) && (flags & MAP_SHARED) ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error{errno, std::generic_category(), path};
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      auto error = errno;
+      ::close(fd);
+      throw std::system_error{error, std::generic_category(), path};
+    }
+    auto size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+      ::close(fd);
+      return Buffer{};
+    }
+    auto mapping = mmap(nullptr, size, protection, flags | (options.populate ? MAP_POPULATE : 0), fd, 0);
+    auto error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+      throw std::system_error{error, std::generic_category(), path};
+    if (options.advise_huge_pages)
+      madvise(mapping, size, MADV_HUGEPAGE);
+    if (options.advice != MapAdvice::Normal)
+      internal::advise_pages(static_cast<char*>(mapping), size, options.advice);
+    auto data = internal::make_buffer_data();
+    data->map(static_cast<char*>(mapping), size);
+    return Buffer{std::move(data), 0, size};
+  }
+#endif
+
+  /**
+   * Shallow copy that shares the underlying data, used by Cow.
+   */
+  Buffer share() const {
+    BufferDataPtr data{_data};
+    return Buffer{std::move(data), _offset, _size};
+  }
+
+public:
+  static const size_t npos = -1;
+
+  /**
+   * Wrap the given raw pointer at the given offset/size.
+   * Beware ownership: you must ensure the raw pointer remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  static const Buffer wrap(const char* data, size_t offset, size_t size) {
+    return Buffer{internal::make_buffer_data(const_cast<char*>(data), offset, size), 0, size};
+  }
+
+  /**
+   * Wrap the given raw pointer at the given offset/size.
+   * Beware ownership: you must ensure the raw pointer remains valid.
+   * Consider wrap(std::shared_ptr<char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  static Buffer wrap(char* data, size_t offset, size_t size) {
+    return Buffer{internal::make_buffer_data(data, offset, size), 0, size};
+  }
+
+  /**
+   * Wrap the given shared_ptr buffer at the given offset/size.
+   */
+  static const Buffer wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) {
+    return Buffer{internal::make_buffer_data(std::const_pointer_cast<char[]>(data), offset, size), 0, size};
+  }
+
+  /**
+   * Wrap the given shared_ptr buffer at the given offset/size.
+   */
+  static Buffer wrap(std::shared_ptr<char[]> data, size_t offset, size_t size) {
+    return Buffer{internal::make_buffer_data(data, offset, size), 0, size};
+  }
+
+  /**
+   * Wrap the given string.
+   * Beware ownership: you must ensure the referenced string remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  static Buffer wrap(const std::string& string) {
+    return wrap(string.data(), 0, string.size());
+  }
+
+  /**
+   * Wrap the given string_view.
+   * Beware ownership: you must ensure the referenced string remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  static const Buffer wrap(const std::string_view& string) {
+    return wrap(string.data(), 0, string.size());
+  }
+
+  /**
+   * Wrap the given span.
+   * Beware ownership: you must ensure the span's underlying data remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static const Buffer wrap(const std::span<const T>& span) {
+    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
+    auto size = span.size() * sizeof(T);
+    return Buffer{internal::make_buffer_data(data, 0, size), 0, size};
+  }
+
+  /**
+   * Wrap the given span.
+   * Beware ownership: you must ensure the span's underlying data remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer wrap(const std::span<T>& span) {
+    auto data = reinterpret_cast<char*>(span.data());
+    auto size = span.size() * sizeof(T);
+    return Buffer{internal::make_buffer_data(data, 0, size), 0, size};
+  }
+
+  /**
+   * Wrap the given span.
+   * Beware ownership: you must ensure the span's underlying data remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static const Buffer wrap(const std::span<const T, N>& span) {
+    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
+    size_t size = span.size() * sizeof(T);
+    return Buffer{internal::make_buffer_data(data, 0, size), 0, size};
+  }
+
+  /**
+   * Wrap the given span.
+   * Beware ownership: you must ensure the span's underlying data remains valid.
+   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   */
+  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer wrap(const std::span<T, N>& span) {
+    auto data = reinterpret_cast<char*>(span.data());
+    size_t size = span.size() * sizeof(T);
+    return Buffer{internal::make_buffer_data(data, 0, size), 0, size};
+  }
+
+  /**
+   * Allocate a buffer of the given size.
+   * The reference count, bookkeeping and payload share a single heap allocation.
+   */
+  static Buffer allocate(size_t size) {
+    return Buffer{internal::allocate_buffer_data(size), 0, size};
+  }
+
+  /**
+   * Allocate a buffer of the given size from the given memory resource.
+   * The resource must outlive the returned buffer and every span and copy made from it.
+   */
+  static Buffer allocate(size_t size, std::pmr::memory_resource* resource) {
+    return Buffer{internal::allocate_buffer_data(size, resource), 0, size};
+  }
+
+  /**
+   * Allocate a buffer of the given size that is guaranteed never to be written by the allocation.
+   * Large buffers are mapped directly, so their pages are not faulted in until first written,
+   * which suits buffers that are immediately filled by read(2) or memcpy.
+   */
+  static Buffer allocate_uninitialized(size_t size) {
+    if (size < internal::mapped_heap_threshold)
+      return allocate(size);
+    return Buffer{internal::allocate_heap_buffer_data(size), 0, size};
+  }
+
+#if defined(__linux__)
+  /**
+   * Map the given file read-only. The mapping is owned by the underlying data and unmapped when the returned buffer
+   * and all of its spans are gone. Pages are read from the file as they are first accessed, unless
+   * options.populate is set. Throws std::system_error if the file cannot be opened or mapped.
+   * The memory is mapped PROT_READ, so the result is a ReadOnlyBuffer, which has no way to write to it.
+   * Use the MapMode overload to write.
+   */
+  static ReadOnlyBuffer map_file(const std::string& path, MapOptions options = {});
+
+  /**
+   * Map the given file read-write, writing through to the file with MapMode::Shared.
+   * The file keeps its size, so the buffer cannot grow.
+   */
+  static Buffer map_file(const std::string& path, MapMode mode, MapOptions options = {}) {
+    return mmap_file(path, PROT_READ | PROT_WRITE, mode == MapMode::Shared ? MAP_SHARED : MAP_PRIVATE, options);
+  }
+#endif
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given data into it.
+   */
+  static Buffer copy_of(const char* data, size_t offset, size_t size) {
+    return copy_of(data, offset, size, nullptr);
+  }
+
+  /**
+   * Allocate a new Buffer from the given memory resource and copy the contents of the given data into it.
+   */
+  static Buffer copy_of(const char* data, size_t offset, size_t size, std::pmr::memory_resource* resource) {
+    auto buffer = Buffer::allocate(size, resource);
+    memcpy(buffer.raw_data(), reinterpret_cast<const char*>(data + offset), size);
+    return buffer;
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given string into it.
+   */
+  static Buffer copy_of(const std::string& string) {
+    return copy_of(string.data(), 0, string.size());
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given string_view into it.
+   */
+  static Buffer copy_of(const std::string_view& string) {
+    return copy_of(string.data(), 0, string.size());
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given span into it.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer copy_of(const std::span<const T>& span) {
+    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
+    auto size = span.size() * sizeof(T);
+    return copy_of(data, 0, size);
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given span into it.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer copy_of(const std::span<T>& span) {
+    auto data = reinterpret_cast<char*>(span.data());
+    size_t size = span.size() * sizeof(T);
+    return copy_of(data, 0, size);
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given span into it.
+   */
+  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer copy_of(const std::span<const T, N>& span) {
+    auto data = reinterpret_cast<const char*>(span.data());
+    size_t size = span.size() * sizeof(T);
+    return copy_of(data, 0, size);
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given span into it.
+   */
+  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  static Buffer copy_of(const std::span<T, N>& span) {
+    auto data = reinterpret_cast<char*>(span.data());
+    size_t size = span.size() * sizeof(T);
+    return copy_of(data, 0, size);
+  }
+
+  /**
+   * Allocate a new Buffer and copy the contents of the given Buffer into it.
+   */
+  static Buffer copy_of(const Buffer& buffer_span) {
+    return copy_of(buffer_span.data(), 0, buffer_span.size());
+  }
+
+  /**
+   * Allocate a new Buffer and decode the given hex string into it.
+   * The string may start with a "0x" prefix and may use either case.
+   * Throws std::invalid_argument if the string has an odd number of digits or a character that is not a hex digit.
+   */
+  static Buffer from_hex(const std::string_view& hex) {
+    auto digits = hex.starts_with("0x") || hex.starts_with("0X") ? hex.substr(2) : hex;
+    if (digits.size() % 2 != 0)
+      throw std::invalid_argument{"odd number of hex digits"};
+    auto buffer = Buffer::allocate_uninitialized(digits.size() / 2);
+    if (!internal::hex_decode(buffer.raw_data(), digits.data(), buffer.size()))
+      throw std::invalid_argument{"invalid hex digit"};
+    return buffer;
+  }
+
+  /**
+   * Create a buffer with size=0 and set underlying data to nullptr
+   */
+  Buffer() : _data{internal::make_buffer_data()}, _offset{0}, _size{0} {};
+
+  /**
+   * Adopt the given string as the underlying data without copying it.
+   * The string is kept alive by this buffer and all of its spans.
+   */
+  explicit Buffer(std::string&& string) : Buffer{internal::adopt_buffer_data(std::move(string)), 0, 0} {
+    _size = _data->capacity();
+  }
+
+  /**
+   * Adopt the given vector as the underlying data without copying it.
+   * The vector is kept alive by this buffer and all of its spans.
+   */
+  explicit Buffer(std::vector<char>&& vector) : Buffer{internal::adopt_buffer_data(std::move(vector)), 0, 0} {
+    _size = _data->capacity();
+  }
+
+  /**
+   * Deep copy, allocating from the same memory resource as rhs
+   */
+  Buffer(const Buffer& rhs) : Buffer{internal::allocate_buffer_data(rhs.size(), rhs._data->resource()), 0, rhs.size()} {
+    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+  }
+
+  /**
+   * Deep copy, allocating from the same memory resource as rhs
+   */
+  Buffer& operator=(const Buffer& rhs) {
+    _data = internal::allocate_buffer_data(rhs.size(), rhs._data->resource());
+    _offset = 0;
+    _size = rhs._size;
+    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+    return *this;
+  }
+
+  Buffer(Buffer&& rhs) = default;
+  Buffer& operator=(Buffer&& rhs) = default;
+  ~Buffer() = default;
+
+  /**
+   * Get the buffer size.
+   */
+  inline size_t size() const noexcept {
+    return _size;
+  }
+
+  /**
+   * Get the memory resource that allocated the underlying data.
+   * Returns std::pmr::new_delete_resource() for data from the global operator new or wrapped memory.
+   */
+  std::pmr::memory_resource* resource() const noexcept {
+    auto resource = _data->resource();
+    return resource ? resource : std::pmr::new_delete_resource();
+  }
+
+  /**
+   * Get how the reference count shared with all spans of the underlying data is maintained.
+   */
+  RefCountPolicy ref_count_policy() const noexcept {
+    return _data->ref_count_policy();
+  }
+
+  /**
+   * Set how the reference count shared with all spans of the underlying data is maintained.
+   * RefCountPolicy::ThreadConfined must only be set while the calling thread holds every reference, and spans must
+   * not be handed to other threads until the policy is set back to RefCountPolicy::Atomic.
+   * Copies always start with RefCountPolicy::Atomic.
+   */
+  void ref_count_policy(RefCountPolicy policy) noexcept {
+    _data->ref_count_policy(policy);
+  }
+
+  /**
+   * Get the raw pointer to the start of the underlying data.
+   */
+  inline char* data() {
+    check_bounds(0, 0);
+    return raw_data();
+  }
+
+  /**
+   * Get the raw pointer to the start of the underlying data.
+   */
+  inline const char* data() const {
+    return const_cast<Buffer&>(*this).data();
+  }
+
+  /**
+   * Get the byte at the given index.
+   * Throws on array index out of bounds.
+   */
+  char& operator[](size_t index) {
+    check_bounds(index, 1);
+    return raw_data()[index];
+  }
+
+  /**
+   * Get the byte at the given index.
+   * Throws on array index out of bounds.
+   */
+  const char& operator[](size_t index) const {
+    return const_cast<Buffer&>(*this)[index];
+  }
+
+  /**
+   * Convert this Buffer to a std::span
+   */
+  operator std::span<char>() {
+    check_bounds(0, size());
+    return std::span{raw_data(), size()};
+  }
+
+  /**
+   * Convert this Buffer to a std::span
+   */
+  operator std::span<const char>() const {
+    check_bounds(0, size());
+    return std::span{raw_data(), size()};
+  }
+
+  /**
+   * Return a copy of any fundamental type from the given index.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  const T read(size_t index) const {
+    check_bounds(index, sizeof(T));
+    T v;
+    memcpy(&v, reinterpret_cast<const char*>(raw_data() + index), sizeof(T));
+    return v;
+  }
+
+  /**
+   * Return a reference to any fundamental type from the given index which is backed by the array
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  const T& ref(size_t index) const {
+    check_bounds(index, sizeof(T));
+    return *reinterpret_cast<const T*>(reinterpret_cast<const char*>(raw_data() + index));
+  }
+
+  /**
+   * Return a reference to any fundamental type from the given index which is backed by the array
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  T& ref(size_t index) {
+    check_bounds(index, sizeof(T));
+    return *reinterpret_cast<T*>(reinterpret_cast<char*>(raw_data() + index));
+  }
+
+  /**
+   * Write any fundamental type to the given index.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  void write(const T& src, size_t index = 0) {
+    check_bounds(index, sizeof(T));
+    memcpy(reinterpret_cast<char*>(raw_data() + index), &src, sizeof(T));
+  }
+
+  /**
+   * Write a span of any fundamental type to the given index.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  void write(const std::span<T>& src, size_t index = 0) {
+    check_bounds(index, sizeof(T) * src.size());
+    memcpy(reinterpret_cast<char*>(raw_data() + index), src.data(), sizeof(T) * src.size());
+  }
+
+  /**
+   * Write a buffer to the given index.
+   */
+  void write(const Buffer& src, size_t index = 0) {
+    check_bounds(index, src.size());
+    memcpy(reinterpret_cast<char*>(raw_data() + index), src.data(), src.size());
+  }
+
+  /**
+   * Write a buffer to the given index.
+   */
+  void write(const Buffer&& src, size_t index = 0) {
+    write(src, index);
+  }
+
+#if defined(__linux__)
+  /**
+   * Hint the expected access pattern of the given range to the kernel, e.g. MapAdvice::WillNeed to start reading a
+   * mapped file ahead of use. Only applies to mapped memory, such as from map_file, and does nothing otherwise.
+   * Throws on array index out of bounds.
+   */
+  void advise(MapAdvice advice, size_t index = 0, size_t size = Buffer::npos) const {
+    if (size == Buffer::npos)
+      size = _size - index;
+    check_bounds(index, size);
+    auto kind = _data->heap_kind();
+    if (kind == internal::HeapKind::File || kind == internal::HeapKind::Mapped)
+      internal::advise_pages(raw_data() + index, size, advice);
+  }
+#endif
+
+  /**
+   * Throw if the given range is out of bounds.
+   * Use this to validate a range once before accessing it with the unchecked accessors.
+   */
+  void check(size_t index, size_t size) const {
+    check_bounds(index, size);
+  }
+
+  /**
+   * Get the raw pointer to the start of the underlying data without bounds checking.
+   */
+  inline char* data_unchecked() noexcept {
+    return raw_data();
+  }
+
+  /**
+   * Get the raw pointer to the start of the underlying data without bounds checking.
+   */
+  inline const char* data_unchecked() const noexcept {
+    return raw_data();
+  }
+
+  /**
+   * Get the byte at the given index without bounds checking.
+   * Behavior is undefined if the index is out of bounds.
+   */
+  inline char& at_unchecked(size_t index) noexcept {
+    return raw_data()[index];
+  }
+
+  /**
+   * Get the byte at the given index without bounds checking.
+   * Behavior is undefined if the index is out of bounds.
+   */
+  inline const char& at_unchecked(size_t index) const noexcept {
+    return raw_data()[index];
+  }
+
+  /**
+   * Return a copy of any fundamental type from the given index without bounds checking.
+   * Behavior is undefined if the range is out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  inline const T read_unchecked(size_t index) const noexcept {
+    T v;
+    memcpy(&v, reinterpret_cast<const char*>(raw_data() + index), sizeof(T));
+    return v;
+  }
+
+  /**
+   * Return a reference to any fundamental type from the given index without bounds checking.
+   * Behavior is undefined if the range is out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  inline const T& ref_unchecked(size_t index) const noexcept {
+    return *reinterpret_cast<const T*>(reinterpret_cast<const char*>(raw_data() + index));
+  }
+
+  /**
+   * Return a reference to any fundamental type from the given index without bounds checking.
+   * Behavior is undefined if the range is out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  inline T& ref_unchecked(size_t index) noexcept {
+    return *reinterpret_cast<T*>(reinterpret_cast<char*>(raw_data() + index));
+  }
+
+  /**
+   * Write any fundamental type to the given index without bounds checking.
+   * Behavior is undefined if the range is out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  inline void write_unchecked(const T& src, size_t index = 0) noexcept {
+    memcpy(reinterpret_cast<char*>(raw_data() + index), &src, sizeof(T));
+  }
+
+  /**
+   * Return a copy of any arithmetic type stored in big-endian (network) order at the given index.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  const T read_be(size_t index) const {
+    return internal::convert_endian<std::endian::big>(read<T>(index));
+  }
+
+  /**
+   * Return a copy of any arithmetic type stored in little-endian order at the given index.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  const T read_le(size_t index) const {
+    return internal::convert_endian<std::endian::little>(read<T>(index));
+  }
+
+  /**
+   * Read an array of arithmetic values stored in big-endian (network) order at the given index into dest.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void read_be(const std::span<T>& dest, size_t index) const {
+    check_bounds(index, sizeof(T) * dest.size());
+    internal::convert_endian_copy<std::endian::big, T>(
+        reinterpret_cast<char*>(dest.data()), raw_data() + index, dest.size());
+  }
+
+  /**
+   * Read an array of arithmetic values stored in little-endian order at the given index into dest.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void read_le(const std::span<T>& dest, size_t index) const {
+    check_bounds(index, sizeof(T) * dest.size());
+    internal::convert_endian_copy<std::endian::little, T>(
+        reinterpret_cast<char*>(dest.data()), raw_data() + index, dest.size());
+  }
+
+  /**
+   * Write any arithmetic type to the given index in big-endian (network) order.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_be(const T& src, size_t index = 0) {
+    write<T>(internal::convert_endian<std::endian::big>(src), index);
+  }
+
+  /**
+   * Write any arithmetic type to the given index in little-endian order.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_le(const T& src, size_t index = 0) {
+    write<T>(internal::convert_endian<std::endian::little>(src), index);
+  }
+
+  /**
+   * Write an array of arithmetic values to the given index in big-endian (network) order.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_be(const std::span<T>& src, size_t index = 0) {
+    check_bounds(index, sizeof(T) * src.size());
+    internal::convert_endian_copy<std::endian::big, std::remove_const_t<T>>(
+        raw_data() + index, reinterpret_cast<const char*>(src.data()), src.size());
+  }
+
+  /**
+   * Write an array of arithmetic values to the given index in little-endian order.
+   */
+  template <typename T, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_le(const std::span<T>& src, size_t index = 0) {
+    check_bounds(index, sizeof(T) * src.size());
+    internal::convert_endian_copy<std::endian::little, std::remove_const_t<T>>(
+        raw_data() + index, reinterpret_cast<const char*>(src.data()), src.size());
+  }
+
+  /**
+   * Get a mutable buffer span that wraps the same underlying data for the given range.
+   * The returned buffer span may outlive the source buffer span.
+   */
+  Buffer span(size_t index = 0, size_t size = Buffer::npos) {
+    if (size == Buffer::npos)
+      size = _size - index;
+    check_bounds(index, size);
+    return Buffer{_data, _offset + index, size};
+  }
+
+  /**
+   * Get a const buffer span that wraps the same underlying data for the given range.
+   * The returned buffer span may outlive the source buffer span.
+   */
+  const Buffer span(size_t index = 0, size_t size = Buffer::npos) const {
+    return const_cast<Buffer&>(*this).span(index, size);
+  }
+
+  /**
+   * Create a copy Buffer of part of the underlying data, allocated from the same memory resource
+   */
+  Buffer copy(size_t index = 0, size_t size = Buffer::npos) const {
+    if (size == Buffer::npos)
+      size = _size - index;
+    check_bounds(index, size);
+    auto result = Buffer{internal::allocate_buffer_data(size, _data->resource()), 0, size};
+    memcpy(result.raw_data(), reinterpret_cast<const char*>(raw_data() + index), size);
+    return result;
+  }
+
+  /**
+   * Fill the data with 0's
+   */
+  void clear() {
+    check_bounds(0, _size);
+    _data->zero(_offset, _size);
+  }
+
+  /**
+   * Convert the contents to a std::string
+   */
+  std::string str() const {
+    check_bounds(0, _size);
+    return std::string{raw_data(), 0, _size};
+  }
+
+  /**
+   * Convert the contents to a hex string
+   */
+  std::string hex() const {
+    std::string result;
+    hex(result);
+    return result;
+  }
+
+  /**
+   * Append the contents as a hex string, prefixed by "0x", to the given string.
+   * Reusing the same string avoids an allocation once its capacity is large enough.
+   */
+  std::string& hex(std::string& dest) const {
+    check_bounds(0, _size);
+    auto offset = dest.size();
+    dest.resize(offset + 2 + 2 * _size);
+    dest[offset] = '0';
+    dest[offset + 1] = 'x';
+    internal::hex_encode(dest.data() + offset + 2, raw_data(), _size);
+    return dest;
+  }
+
+  /**
+   * Write the contents as a hex string, prefixed by "0x", to the given Buffer at the given index.
+   * Writes 2 + 2 * size() bytes and throws if they do not fit.
+   */
+  void hex(Buffer& dest, size_t index = 0) const {
+    check_bounds(0, _size);
+    dest.check_bounds(index, 2 + 2 * _size);
+    auto out = dest.raw_data() + index;
+    out[0] = '0';
+    out[1] = 'x';
+    internal::hex_encode(out + 2, raw_data(), _size);
+  }
+};
+
+/**
+ * A Buffer that can only be read, for memory that must never be written, such as a read-only file mapping.
+ * It exposes only the reading half of the Buffer API, and its spans are ReadOnlyBuffers too, so no mutable
+ * Buffer can be obtained from it. copy() makes a mutable Buffer of new memory.
+ * Copies share the underlying data, since none of them can change it.
+ */
+class ReadOnlyBuffer : private Buffer {
+private:
+  friend class Buffer;
+
+  explicit ReadOnlyBuffer(Buffer&& buffer) noexcept : Buffer{std::move(buffer)} {};
+
+public:
+  using Buffer::npos;
+
+  ReadOnlyBuffer() = default;
+
+  /**
+   * Shallow copy, sharing the underlying data
+   */
+  ReadOnlyBuffer(const ReadOnlyBuffer& rhs) : Buffer{rhs.share()} {};
+
+  /**
+   * Shallow copy, sharing the underlying data
+   */
+  ReadOnlyBuffer& operator=(const ReadOnlyBuffer& rhs) {
+    static_cast<Buffer&>(*this) = rhs.share();
+    return *this;
+  }
+
+  ReadOnlyBuffer(ReadOnlyBuffer&& rhs) = default;
+  ReadOnlyBuffer& operator=(ReadOnlyBuffer&& rhs) = default;
+  ~ReadOnlyBuffer() = default;
+
+  using Buffer::size;
+  using Buffer::resource;
+  using Buffer::read;
+  using Buffer::read_be;
+  using Buffer::read_le;
+  using Buffer::read_unchecked;
+  using Buffer::check;
+  using Buffer::copy;
+  using Buffer::str;
+  using Buffer::hex;
+#if defined(__linux__)
+  using Buffer::advise;
+#endif
+
+  inline const char* data() const {
+    return Buffer::data();
+  }
+
+  inline const char* data_unchecked() const noexcept {
+    return Buffer::data_unchecked();
+  }
+
+  const char& operator[](size_t index) const {
+    return Buffer::operator[](index);
+  }
+
+  /**
+   * Get a ReadOnlyBuffer that shares the same underlying data for the given range.
+   */
+  ReadOnlyBuffer span(size_t index = 0, size_t size = npos) const {
+    return ReadOnlyBuffer{const_cast<ReadOnlyBuffer&>(*this).Buffer::span(index, size)};
+  }
+
+  operator std::span<const char>() const {
+    return Buffer::operator std::span<const char>();
+  }
+};
+
+#if defined(__linux__)
+inline ReadOnlyBuffer Buffer::map_file(const std::string& path, MapOptions options) {
+  return ReadOnlyBuffer{mmap_file(path, PROT_READ, MAP_SHARED, options)};
+}
+#endif
+
+/**
+ * Controls how FlexBuffer grows its capacity when resize, reserve or operator<< need more room.
+ * Below the step threshold the capacity is multiplied by a factor, at or above it a fixed step is added,
+ * and the result is rounded up to a multiple of the granularity.
+ */
+class GrowthPolicy {
+private:
+  size_t _numerator;
+  size_t _denominator;
+  size_t _step_threshold;
+  size_t _step;
+  size_t _granularity;
+
+  constexpr GrowthPolicy(size_t numerator, size_t denominator, size_t step_threshold, size_t step, size_t granularity)
+      : _numerator{numerator},
+        _denominator{denominator},
+        _step_threshold{step_threshold},
+        _step{step},
+        _granularity{granularity} {};
+
+public:
+  static constexpr size_t page_size = 4096;
+  static constexpr size_t huge_page_size = static_cast<size_t>(2) << 20;
+
+  /**
+   * Double the capacity until the size fits. This is the default.
+   */
+  static constexpr GrowthPolicy doubling() noexcept {
+    return GrowthPolicy{2, 1, npos, 0, 1};
+  }
+
+  /**
+   * Grow the capacity by 1.5x, staying below the golden ratio so an allocator can reuse previously freed blocks.
+   */
+  static constexpr GrowthPolicy golden_ratio() noexcept {
+    return GrowthPolicy{3, 2, npos, 0, 1};
+  }
+
+  /**
+   * Grow the capacity to exactly the requested size, never more.
+   */
+  static constexpr GrowthPolicy exact() noexcept {
+    return GrowthPolicy{1, 1, npos, 0, 1};
+  }
+
+  /**
+   * Grow the capacity by 1.5x, rounded up to a multiple of the given page size.
+   * Use GrowthPolicy::huge_page_size to round to 2 MiB hugepages.
+   */
+  static constexpr GrowthPolicy page_rounded(size_t page = page_size) noexcept {
+    return golden_ratio().rounded(page);
+  }
+
+  /**
+   * Double the capacity until it reaches the threshold, then grow by adding a fixed step.
+   */
+  static constexpr GrowthPolicy capped_step(size_t threshold, size_t step) noexcept {
+    return GrowthPolicy{2, 1, threshold, step, 1};
+  }
+
+  /**
+   * Get a copy of this policy that rounds capacities up to a multiple of the given granularity.
+   */
+  constexpr GrowthPolicy rounded(size_t granularity) const noexcept {
+    return GrowthPolicy{_numerator, _denominator, _step_threshold, _step, std::max(static_cast<size_t>(1), granularity)};
+  }
+
+  /**
+   * Get the capacity to grow to from the given current capacity in order to fit the given size.
+   * Returns the current capacity when the size already fits.
+   */
+  constexpr size_t capacity_for(const size_t size, const size_t current_capacity) const noexcept {
+    auto capacity = std::max(static_cast<size_t>(1), current_capacity);
+    while (size > capacity) {
+      if (capacity >= _step_threshold ? _step == 0 || capacity > npos - _step
+                                      : _numerator <= _denominator || capacity > npos / _numerator) {
+        // exact fit, or capacity can no longer grow by the policy on architecture, set capacity to size
+        capacity = size;
+        break;
+      }
+      capacity = capacity >= _step_threshold ? capacity + _step
+                                             : std::max(capacity * _numerator / _denominator, capacity + 1);
+    }
+    if (capacity != current_capacity && capacity % _granularity != 0 && capacity <= npos - _granularity) {
+      capacity += _granularity - capacity % _granularity;
+    }
+    return capacity;
+  }
+
+  constexpr bool operator==(const GrowthPolicy&) const = default;
+
+private:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+};
+
+/**
+ * Controls when FlexBuffer::resize releases memory after the size drops.
+ * A buffer is at low water when its size is below a quarter of its capacity.
+ */
+class ShrinkPolicy {
+public:
+  enum class Mode { Immediate, Never, LowOccupancy, LowWaterCycles };
+
+private:
+  Mode _mode;
+  size_t _cycles;
+
+  constexpr ShrinkPolicy(Mode mode, size_t cycles) : _mode{mode}, _cycles{cycles} {};
+
+public:
+  /**
+   * Shrink to the smallest fitting capacity whenever the size drops. This is the default.
+   */
+  static constexpr ShrinkPolicy immediate() noexcept {
+    return ShrinkPolicy{Mode::Immediate, 0};
+  }
+
+  /**
+   * Never shrink on resize, only on an explicit shrink_to_fit().
+   */
+  static constexpr ShrinkPolicy never() noexcept {
+    return ShrinkPolicy{Mode::Never, 0};
+  }
+
+  /**
+   * Shrink only when the size drops to low water.
+   */
+  static constexpr ShrinkPolicy low_occupancy() noexcept {
+    return ShrinkPolicy{Mode::LowOccupancy, 0};
+  }
+
+  /**
+   * Shrink only when the size has dropped to low water on the given number of consecutive shrinking resizes,
+   * without the buffer filling past low water in between.
+   */
+  static constexpr ShrinkPolicy low_water_cycles(size_t cycles) noexcept {
+    return ShrinkPolicy{Mode::LowWaterCycles, cycles};
+  }
+
+  constexpr Mode mode() const noexcept {
+    return _mode;
+  }
+
+  constexpr size_t cycles() const noexcept {
+    return _cycles;
+  }
+
+  constexpr bool operator==(const ShrinkPolicy&) const = default;
+};
+
+/**
+ * A buffer that always allocates its own memory, can be resized, and can continuously grow to fit more data.
+ * Pass-by-value semantics will deep copy the underlying data - O(n).
+ * The default constructor allocates an initial capacity of the system's byte-alignment length and sets the size to 0.
+ * The capacity automatically grows and shrinks as necessary as the buffer is resized or data is appended,
+ * doubling and halving by default. See GrowthPolicy and ShrinkPolicy.
+ * This class extends Buffer.
+ */
+class FlexBuffer : public Buffer {
+private:
+  friend class BufferPool;
+  friend class AsyncBufferReader;
+  friend class FrameDecoder;
+  template <typename B>
+  friend class Cow;
+  template <size_t N>
+  friend class SmallFlexBuffer;
+
+  size_t _initial_capacity;
+  GrowthPolicy _growth_policy = GrowthPolicy::doubling();
+  ShrinkPolicy _shrink_policy = ShrinkPolicy::immediate();
+  size_t _low_water_cycles = 0;
+
+  FlexBuffer(size_t initial_capacity, size_t allocate_size, std::pmr::memory_resource* resource)
+      : Buffer{internal::allocate_heap_buffer_data(allocate_size, resource), 0, 0},
+        _initial_capacity{initial_capacity} {};
+  FlexBuffer(BufferDataPtr&& data, size_t initial_capacity)
+      : Buffer{std::move(data), 0, 0}, _initial_capacity{initial_capacity} {};
+
+  size_t capacity_for(const size_t size, const size_t min_capacity) const noexcept {
+    return _growth_policy.capacity_for(size, min_capacity);
+  }
+
+#if defined(__linux__)
+  static FlexBuffer fd_backed(int fd, size_t initial_capacity) {
+    auto data = internal::make_buffer_data();
+    data->map_file(fd, initial_capacity);
+    return FlexBuffer{std::move(data), initial_capacity};
+  }
+#endif
+
+  /**
+   * Decide whether a resize down to the given size should release memory, according to the shrink policy.
+   */
+  bool should_shrink(size_t size) noexcept {
+    auto low_water = size < _data->capacity() / 4;
+    switch (_shrink_policy.mode()) {
+    case ShrinkPolicy::Mode::Immediate:
+      return true;
+    case ShrinkPolicy::Mode::Never:
+      return false;
+    case ShrinkPolicy::Mode::LowOccupancy:
+      return low_water;
+    case ShrinkPolicy::Mode::LowWaterCycles:
+      if (low_water && ++_low_water_cycles >= _shrink_policy.cycles()) {
+        _low_water_cycles = 0;
+        return true;
+      }
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Drop the first consumed bytes, e.g. input already parsed, once they are at least half of the data, moving the
+   * rest to the front. While spans of the data are alive, the rest is copied to new memory instead, leaving the
+   * spans intact. Returns whether the bytes were dropped.
+   */
+  bool compact_front(size_t consumed) {
+    if (consumed == 0 || consumed < _size - consumed)
+      return false;
+    auto remaining = _size - consumed;
+    if (_data.use_count() == 1) {
+      memmove(data_unchecked(), data_unchecked() + consumed, remaining);
+      _size = remaining;
+    } else {
+      FlexBuffer fresh{_initial_capacity, _initial_capacity, _data->resource()};
+      fresh._growth_policy = _growth_policy;
+      fresh._shrink_policy = _shrink_policy;
+      fresh << span(consumed, remaining);
+      *this = std::move(fresh);
+    }
+    return true;
+  }
+
+public:
+  /**
+   * Sets size=0 and pre-allocates a buffer to the given initial_capacity,
+   * which defaults to the system's byte-alignment size.
+   */
+  FlexBuffer(size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      : FlexBuffer{initial_capacity, initial_capacity, nullptr} {};
+
+  /**
+   * Adopt the given string as the underlying data without copying it, with size and capacity of the string's size.
+   * The string backs the buffer until it grows, and can be handed back with release_string().
+   */
+  explicit FlexBuffer(std::string&& string, size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      : FlexBuffer{internal::adopt_buffer_data(std::move(string)), initial_capacity} {
+    _size = _data->capacity();
+  }
+
+  /**
+   * Adopt the given vector as the underlying data without copying it, with size and capacity of the vector's size.
+   * The vector backs the buffer until it grows, and can be handed back with release_vector().
+   */
+  explicit FlexBuffer(std::vector<char>&& vector, size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      : FlexBuffer{internal::adopt_buffer_data(std::move(vector)), initial_capacity} {
+    _size = _data->capacity();
+  }
+
+  /**
+   * Sets size=0 and pre-allocates a buffer to the given initial_capacity from the given memory resource.
+   * All growth of this buffer is allocated from the same resource, which must outlive this buffer and its spans.
+   */
+  FlexBuffer(size_t initial_capacity, std::pmr::memory_resource* resource)
+      : FlexBuffer{initial_capacity, initial_capacity, resource} {};
+
+#if defined(__linux__)
+  /**
+   * Create an empty FlexBuffer whose memory is a shared mapping of the given file, which is created or truncated.
+   * The file grows and shrinks with the capacity, so the kernel can page the data out to it under memory pressure.
+   * Copies, and the buffer after release(), use ordinary heap memory.
+   * Throws std::system_error if the file cannot be created or mapped.
+   */
+  static FlexBuffer file_backed(const std::string& path, size_t initial_capacity = internal::page_size()) {
+    auto fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+      throw std::system_error{errno, std::generic_category(), path};
+    return fd_backed(fd, initial_capacity);
+  }
+
+  /**
+   * Create an empty FlexBuffer backed by an anonymous memfd, as for file_backed, so its data can be swapped out
+   * as shared memory. Throws std::system_error if the memfd cannot be created or mapped.
+   */
+  static FlexBuffer memfd_backed(size_t initial_capacity = internal::page_size()) {
+    auto fd = memfd_create("flexbuf", MFD_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error{errno, std::generic_category(), "memfd_create"};
+    return fd_backed(fd, initial_capacity);
+  }
+#endif
+
+  /**
+   * Deep copy, allocating from the same memory resource as rhs
+   */
+  FlexBuffer(const FlexBuffer& rhs) : FlexBuffer{rhs._initial_capacity, rhs.capacity(), rhs._data->resource()} {
+    _size = rhs._size;
+    _growth_policy = rhs._growth_policy;
+    _shrink_policy = rhs._shrink_policy;
+    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+  }
+
+  /**
+   * Deep copy, allocating from the same memory resource as rhs
+   */
+  FlexBuffer& operator=(const FlexBuffer& rhs) {
+    _data = internal::allocate_heap_buffer_data(rhs.capacity(), rhs._data->resource());
+    _offset = 0;
+    _size = rhs._size;
+    _initial_capacity = rhs._initial_capacity;
+    _growth_policy = rhs._growth_policy;
+    _shrink_policy = rhs._shrink_policy;
+    _low_water_cycles = 0;
+    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+    return *this;
+  }
+
+  /**
+   * Move
+   */
+  FlexBuffer(FlexBuffer&& rhs)
+      : Buffer{std::move(rhs._data), rhs._offset, rhs._size},
+        _initial_capacity{rhs._initial_capacity},
+        _growth_policy{rhs._growth_policy},
+        _shrink_policy{rhs._shrink_policy},
+        _low_water_cycles{rhs._low_water_cycles} {
+    rhs._offset = 0;
+    rhs._size = 0;
+  }
+
+  /**
+   * Move
+   */
+  FlexBuffer& operator=(FlexBuffer&& rhs) {
+    _data = std::move(rhs._data);
+    _offset = rhs._offset;
+    _size = rhs._size;
+    _initial_capacity = rhs._initial_capacity;
+    _growth_policy = rhs._growth_policy;
+    _shrink_policy = rhs._shrink_policy;
+    _low_water_cycles = rhs._low_water_cycles;
+    rhs._offset = 0;
+    rhs._size = 0;
+    return *this;
+  }
+  ~FlexBuffer() = default;
+
+  /**
+   * Get the initial capacity.
+   * The underlying memory will never reallocate smaller than this size.
+   */
+  inline size_t initial_capacity() const noexcept {
+    return _initial_capacity;
+  }
+
+  /**
+   * Get the current capacity of this buffer.
+   * This represents the maximum this buffer can be resized without undergoing a reallocation and copy.
+   */
+  inline size_t capacity() const noexcept {
+    return _data->capacity();
+  }
+
+  /**
+   * Get the policy deciding how the underlying memory grows.
+   */
+  inline GrowthPolicy growth_policy() const noexcept {
+    return _growth_policy;
+  }
+
+  /**
+   * Set the policy deciding how the underlying memory grows.
+   */
+  inline void growth_policy(GrowthPolicy policy) noexcept {
+    _growth_policy = policy;
+  }
+
+  /**
+   * Get the policy deciding when resize releases memory after the size drops.
+   */
+  inline ShrinkPolicy shrink_policy() const noexcept {
+    return _shrink_policy;
+  }
+
+  /**
+   * Set the policy deciding when resize releases memory after the size drops.
+   */
+  inline void shrink_policy(ShrinkPolicy policy) noexcept {
+    _shrink_policy = policy;
+    _low_water_cycles = 0;
+  }
+
+  /**
+   * Clear the entirety of the underlying allocated memory.
+   * Whole pages of large buffers are returned to the kernel rather than written.
+   */
+  inline void clear_all() noexcept {
+    _data->zero(0, _data->capacity());
+  }
+
+  /**
+   * Allocate a new FlexBuffer consisting of the contents of this buffer for the given range.
+   * The copy allocates from the same memory resource as this buffer.
+   */
+  inline FlexBuffer flex_copy(size_t index = 0, size_t size = FlexBuffer::npos) const {
+    if (size == FlexBuffer::npos)
+      size = _size - index;
+    check_bounds(index, size);
+    auto allocate_size = capacity_for(size, _initial_capacity);
+    FlexBuffer result{_initial_capacity, allocate_size, _data->resource()};
+    result._growth_policy = _growth_policy;
+    result._shrink_policy = _shrink_policy;
+    result.append(raw_data(), index, size);
+    return result;
+  }
+
+  /**
+   * Set the current size, and grow or shrink the underlying memory as necessary.
+   * Growth follows the growth policy, which doubles by default, and shrinking is subject to the shrink policy.
+   * By default all data through the current size is copied.
+   * Optionally, setting mode=ResizeMode::IgnoreData can disable the copy behavior,
+   * and mode=ResizeMode::Uninitialized additionally guarantees fresh memory that is not faulted in until written.
+   * Throws std::bad_alloc if memory cannot be allocated, and std::system_error if a file-backed buffer's file cannot
+   * be resized (e.g. ENOSPC), leaving the buffer unchanged.
+   * Throws std::logic_error if the memory would move while an IoUring operation on it is in flight.
+   */
+  void resize(size_t size, ResizeMode mode = ResizeMode::KeepData) {
+    if (size > _size) {
+      auto new_capacity = capacity_for(size, _data->capacity());
+      if (new_capacity != _data->capacity()) {
+        _data->resize(mode, new_capacity);
+      }
+      if (size >= _data->capacity() / 4) {
+        _low_water_cycles = 0;
+      }
+    } else if (should_shrink(size)) {
+      auto new_capacity = capacity_for(size, _initial_capacity);
+      if (new_capacity != _data->capacity()) {
+        _data->resize(mode, new_capacity);
+      }
+    }
+    _size = size;
+  }
+
+  /**
+   * Shrink the underlying memory to the smallest capacity that fits the current size, regardless of shrink policy.
+   * Throws as resize().
+   */
+  void shrink_to_fit() {
+    auto new_capacity = capacity_for(_size, _initial_capacity);
+    if (new_capacity != _data->capacity()) {
+      _data->resize(ResizeMode::KeepData, new_capacity);
+    }
+    _low_water_cycles = 0;
+  }
+
+  /**
+   * Hand out the underlying memory, holding size() bytes of data, and reset this buffer to empty.
+   * Heap memory is handed out without copying when no spans reference it, otherwise the data is copied.
+   */
+  ReleasedPtr release() {
+    ReleasedPtr result;
+    auto kind = _data->heap_kind();
+    if (_data.use_count() == 1 &&
+        (kind == internal::HeapKind::Malloc || kind == internal::HeapKind::Mapped ||
+         kind == internal::HeapKind::Resource)) {
+      ReleaseDeleter deleter{kind, _data->resource(), _data->capacity()};
+      result = ReleasedPtr{_data->release_heap(), deleter};
+    } else {
+      auto copy = static_cast<char*>(std::malloc(std::max(static_cast<size_t>(1), _size)));
+      if (!copy)
+        throw std::bad_alloc{};
+      memcpy(copy, raw_data(), _size);
+      result = ReleasedPtr{copy, ReleaseDeleter{internal::HeapKind::Malloc, nullptr, _size}};
+    }
+    reset();
+    return result;
+  }
+
+  /**
+   * Hand out the data as a std::string and reset this buffer to empty.
+   * An adopted string is handed back without copying when no spans reference it, otherwise the data is copied.
+   */
+  std::string release_string() {
+    return release_owner<std::string>();
+  }
+
+  /**
+   * Hand out the data as a std::vector<char> and reset this buffer to empty.
+   * An adopted vector is handed back without copying when no spans reference it, otherwise the data is copied.
+   */
+  std::vector<char> release_vector() {
+    return release_owner<std::vector<char>>();
+  }
+
+#if defined(__linux__)
+  /**
+   * For a file-backed buffer, truncate the file to exactly size() and flush the data to it, so the file holds
+   * the contents of this buffer. Does nothing for other buffers. Throws std::system_error on failure.
+   */
+  void sync() {
+    if (!_data->file_backed())
+      return;
+    if (_data->capacity() != _size)
+      _data->resize_file(_size);
+    _data->sync_file();
+  }
+#endif
+
+  /**
+   * Grow the underlying memory to fit at least the given capacity, without changing the size.
+   * The capacity grows according to the growth policy, and no reallocation happens until it is exceeded
+   * or a shrinking resize releases it according to the shrink policy.
+   * Throws as resize().
+   */
+  void reserve_capacity(size_t capacity) {
+    if (capacity > _data->capacity()) {
+      _data->resize(ResizeMode::KeepData, capacity_for(capacity, _data->capacity()));
+    }
+  }
+
+  /**
+   * Increment the total size by the given size, and return a writable Buffer that wraps this new memory.
+   * Throws as resize().
+   */
+  inline Buffer reserve(size_t size) {
+    auto offset = _size;
+    resize(_size + size);
+    return Buffer{_data, offset, size};
+  }
+
+  /**
+   * Append the given buffer to the end of this FlexBuffer, growing by the given buffer's size.
+   * Appending throws as resize() if the buffer cannot grow.
+   */
+  FlexBuffer& operator<<(const Buffer& buffer) {
+    return append(buffer.data(), 0, buffer.size());
+  }
+
+  /**
+   * Append the given string to the end of this FlexBuffer, growing by the given string's size.
+   */
+  FlexBuffer& operator<<(const std::string_view& string) {
+    return append(string.data(), 0, string.size());
+  }
+
+  /**
+   * Append any fundamental type to the end of this FlexBuffer, growing by the given type's size.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  FlexBuffer& operator<<(const T& src) {
+    auto dest = reserve(sizeof(T));
+    memcpy(dest.data(), &src, sizeof(T));
+    return *this;
+  }
+
+private:
+  template <typename Owner>
+  Owner release_owner() {
+    Owner result;
+    auto owner = _data->owner<Owner>();
+    if (owner && _data.use_count() == 1) {
+      result = std::move(*owner);
+      result.resize(_size);
+    } else {
+      result.assign(raw_data(), raw_data() + _size);
+    }
+    reset();
+    return result;
+  }
+
+  void reset() {
+    auto policy = _data->ref_count_policy();
+    _data = internal::allocate_heap_buffer_data(_initial_capacity, _data->resource());
+    _data->ref_count_policy(policy);
+    _size = 0;
+    _low_water_cycles = 0;
+  }
+
+  /**
+   * Shallow copy that shares the underlying data, used by Cow.
+   */
+  FlexBuffer share() const {
+    BufferDataPtr data{_data};
+    FlexBuffer result{std::move(data), _initial_capacity};
+    result._size = _size;
+    result._growth_policy = _growth_policy;
+    result._shrink_policy = _shrink_policy;
+    return result;
+  }
+
+  inline FlexBuffer& append(const char* src, size_t offset, size_t size) {
+    auto dest = reserve(size);
+    memcpy(dest.data(), reinterpret_cast<const char*>(src + offset), size);
+    return *this;
+  }
+};
+
+/**
+ * A copy-on-write Buffer or FlexBuffer.
+ * Copies share the underlying data, and the first mutating access through a copy whose data is still referenced
+ * elsewhere detaches it onto a deep copy first, so read-only consumers of the same payload never copy it.
+ * Spans are CowBuffers that share the data, so writing through a span detaches it rather than mutating the others.
+ * Mutable access to the full Buffer or FlexBuffer API is available through detach().
+ */
+template <typename B>
+class Cow : private B {
+private:
+  static constexpr bool is_flex = std::is_same_v<B, FlexBuffer>;
+
+  inline void detach_if_shared() {
+    if (shared()) [[unlikely]]
+      static_cast<B&>(*this) = B{static_cast<const B&>(*this)};
+  }
+
+  /**
+   * Detach from other copies if shared, onto fresh memory without copying the data, which is about to be discarded.
+   */
+  inline void detach_discarding_data()
+    requires is_flex
+  {
+    if (!shared()) [[likely]]
+      return;
+    FlexBuffer fresh{B::initial_capacity(), static_cast<const Buffer&>(*this)._data->resource()};
+    fresh.growth_policy(B::growth_policy());
+    fresh.shrink_policy(B::shrink_policy());
+    static_cast<B&>(*this) = std::move(fresh);
+  }
+
+public:
+  using B::npos;
+
+  Cow() = default;
+
+  /**
+   * Take the given buffer, which is moved from when given an rvalue and deep copied otherwise.
+   */
+  explicit Cow(B buffer) : B{std::move(buffer)} {};
+
+  /**
+   * Shallow copy, sharing the underlying data until either copy is mutated
+   */
+  Cow(const Cow& rhs) : B{rhs.B::share()} {};
+
+  /**
+   * Shallow copy, sharing the underlying data until either copy is mutated
+   */
+  Cow& operator=(const Cow& rhs) {
+    static_cast<B&>(*this) = rhs.B::share();
+    return *this;
+  }
+
+  Cow(Cow&& rhs) = default;
+  Cow& operator=(Cow&& rhs) = default;
+  ~Cow() = default;
+
+  /**
+   * Check whether the underlying data is referenced by another copy or span, so that mutation would detach.
+   */
+  inline bool shared() const noexcept {
+    return static_cast<const Buffer&>(*this)._data.use_count() > 1;
+  }
+
+  /**
+   * Get the underlying buffer for reading.
+   */
+  inline const B& buffer() const noexcept {
+    return *this;
+  }
+
+  /**
+   * Detach from other copies if shared, and get the underlying buffer for mutation.
+   * Spans taken from the returned buffer share its data with later copies of this Cow.
+   */
+  B& detach() {
+    detach_if_shared();
+    return *this;
+  }
+
+  using B::check;
+  using B::copy;
+  using B::hex;
+  using B::read;
+  using B::read_be;
+  using B::read_le;
+  using B::read_unchecked;
+  using B::ref_count_policy;
+  using B::resource;
+  using B::size;
+  using B::str;
+
+  inline const char* data() const {
+    return B::data();
+  }
+
+  inline char* data() {
+    detach_if_shared();
+    return B::data();
+  }
+
+  const char& operator[](size_t index) const {
+    return B::operator[](index);
+  }
+
+  char& operator[](size_t index) {
+    detach_if_shared();
+    return B::operator[](index);
+  }
+
+  template <typename T>
+  const T& ref(size_t index) const {
+    return B::template ref<T>(index);
+  }
+
+  template <typename T>
+  T& ref(size_t index) {
+    detach_if_shared();
+    return B::template ref<T>(index);
+  }
+
+  inline const char* data_unchecked() const noexcept {
+    return B::data_unchecked();
+  }
+
+  inline const char& at_unchecked(size_t index) const noexcept {
+    return B::at_unchecked(index);
+  }
+
+  template <typename T>
+  inline const T& ref_unchecked(size_t index) const noexcept {
+    return B::template ref_unchecked<T>(index);
+  }
+
+  template <typename T = void, typename... Args>
+  void write(Args&&... args) {
+    detach_if_shared();
+    if constexpr (std::is_void_v<T>)
+      B::write(std::forward<Args>(args)...);
+    else
+      B::template write<T>(std::forward<Args>(args)...);
+  }
+
+  template <typename T = void, typename... Args>
+  void write_be(Args&&... args) {
+    detach_if_shared();
+    if constexpr (std::is_void_v<T>)
+      B::write_be(std::forward<Args>(args)...);
+    else
+      B::template write_be<T>(std::forward<Args>(args)...);
+  }
+
+  template <typename T = void, typename... Args>
+  void write_le(Args&&... args) {
+    detach_if_shared();
+    if constexpr (std::is_void_v<T>)
+      B::write_le(std::forward<Args>(args)...);
+    else
+      B::template write_le<T>(std::forward<Args>(args)...);
+  }
+
+  void clear() {
+    detach_if_shared();
+    B::clear();
+  }
+
+  /**
+   * Get a CowBuffer that shares the same underlying data for the given range.
+   * Writing through it detaches it onto a copy, leaving this buffer and its other copies unchanged.
+   */
+  Cow<Buffer> span(size_t index = 0, size_t size = npos) const {
+    return Cow<Buffer>{const_cast<Cow&>(*this).B::span(index, size)};
+  }
+
+  operator std::span<const char>() const {
+    return B::operator std::span<const char>();
+  }
+
+  size_t capacity() const noexcept
+    requires is_flex
+  {
+    return B::capacity();
+  }
+
+  size_t initial_capacity() const noexcept
+    requires is_flex
+  {
+    return B::initial_capacity();
+  }
+
+  FlexBuffer flex_copy(size_t index = 0, size_t size = npos) const
+    requires is_flex
+  {
+    return B::flex_copy(index, size);
+  }
+
+  GrowthPolicy growth_policy() const noexcept
+    requires is_flex
+  {
+    return B::growth_policy();
+  }
+
+  void growth_policy(GrowthPolicy policy) noexcept
+    requires is_flex
+  {
+    B::growth_policy(policy);
+  }
+
+  ShrinkPolicy shrink_policy() const noexcept
+    requires is_flex
+  {
+    return B::shrink_policy();
+  }
+
+  void shrink_policy(ShrinkPolicy policy) noexcept
+    requires is_flex
+  {
+    B::shrink_policy(policy);
+  }
+
+  void clear_all()
+    requires is_flex
+  {
+    detach_if_shared();
+    B::clear_all();
+  }
+
+  /**
+   * Resize, detaching if shared. With ResizeMode::IgnoreData or ResizeMode::Uninitialized, a shared buffer is
+   * detached onto fresh memory without copying the data first.
+   */
+  void resize(size_t size, ResizeMode mode = ResizeMode::KeepData)
+    requires is_flex
+  {
+    if (mode == ResizeMode::KeepData)
+      detach_if_shared();
+    else
+      detach_discarding_data();
+    B::resize(size, mode);
+  }
+
+  void reserve_capacity(size_t capacity)
+    requires is_flex
+  {
+    detach_if_shared();
+    B::reserve_capacity(capacity);
+  }
+
+  void shrink_to_fit()
+    requires is_flex
+  {
+    detach_if_shared();
+    B::shrink_to_fit();
+  }
+
+  /**
+   * Hand out the data and reset to empty, copying when shared.
+   */
+  ReleasedPtr release()
+    requires is_flex
+  {
+    return B::release();
+  }
+
+  std::string release_string()
+    requires is_flex
+  {
+    return B::release_string();
+  }
+
+  std::vector<char> release_vector()
+    requires is_flex
+  {
+    return B::release_vector();
+  }
+
+  template <typename T>
+  Cow& operator<<(const T& src)
+    requires is_flex
+  {
+    detach_if_shared();
+    B::operator<<(src);
+    return *this;
+  }
+};
+
+/**
+ * A copy-on-write Buffer, see Cow.
+ */
+using CowBuffer = Cow<Buffer>;
+
+/**
+ * A copy-on-write FlexBuffer, see Cow.
+ */
+using CowFlexBuffer = Cow<FlexBuffer>;
+
+/**
+ * A growable buffer that keeps up to N bytes inside the object, without any heap allocation.
+ * It spills to a heap-allocated FlexBuffer when it grows beyond N bytes, or when span() needs data that can outlive
+ * this object. Once spilled, the data stays in the FlexBuffer.
+ * Pass-by-value will deep copy.
+ */
+template <size_t N>
+class SmallFlexBuffer {
+private:
+  static_assert(N > 0, "SmallFlexBuffer needs inline capacity");
+
+  alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) char _inline[N];
+  size_t _size = 0;
+  std::optional<FlexBuffer> _flex;
+
+  inline void check_bounds(size_t index, size_t size) const {
+    auto limit = this->size();
+    if (index > limit || size > limit - index)
+      throw std::range_error{"array index out of bounds"};
+  }
+
+  /**
+   * Move the inline data to a FlexBuffer with room for at least the given capacity.
+   */
+  void spill(size_t capacity) {
+    if (_flex)
+      return;
+    auto allocate_size = GrowthPolicy::doubling().capacity_for(capacity, N);
+    _flex = FlexBuffer{N, allocate_size, nullptr};
+    _flex->resize(_size, ResizeMode::Uninitialized);
+    memcpy(_flex->data(), _inline, _size);
+  }
+
+public:
+  static const size_t npos = -1;
+
+  SmallFlexBuffer() noexcept {};
+
+  /**
+   * Deep copy
+   */
+  SmallFlexBuffer(const SmallFlexBuffer& rhs) : _size{rhs._size}, _flex{rhs._flex} {
+    if (!_flex)
+      memcpy(_inline, rhs._inline, _size);
+  }
+
+  /**
+   * Deep copy
+   */
+  SmallFlexBuffer& operator=(const SmallFlexBuffer& rhs) {
+    if (this == &rhs)
+      return *this;
+    _size = rhs._size;
+    _flex = rhs._flex;
+    if (!_flex)
+      memcpy(_inline, rhs._inline, _size);
+    return *this;
+  }
+
+  SmallFlexBuffer(SmallFlexBuffer&& rhs) noexcept : _size{rhs._size}, _flex{std::move(rhs._flex)} {
+    if (!_flex)
+      memcpy(_inline, rhs._inline, _size);
+    rhs._size = 0;
+    rhs._flex.reset();
+  }
+
+  SmallFlexBuffer& operator=(SmallFlexBuffer&& rhs) noexcept {
+    if (this == &rhs)
+      return *this;
+    _size = rhs._size;
+    _flex = std::move(rhs._flex);
+    if (!_flex)
+      memcpy(_inline, rhs._inline, _size);
+    rhs._size = 0;
+    rhs._flex.reset();
+    return *this;
+  }
+
+  ~SmallFlexBuffer() = default;
+
+  /**
+   * Get the number of bytes that fit inside the object before spilling to the heap.
+   */
+  static constexpr size_t inline_capacity() noexcept {
+    return N;
+  }
+
+  /**
+   * Check whether the data has spilled to a heap-allocated FlexBuffer.
+   */
+  inline bool spilled() const noexcept {
+    return _flex.has_value();
+  }
+
+  /**
+   * Get the buffer size.
+   */
+  inline size_t size() const noexcept {
+    return _flex ? _flex->size() : _size;
+  }
+
+  /**
+   * Get the current capacity of this buffer.
+   */
+  inline size_t capacity() const noexcept {
+    return _flex ? _flex->capacity() : N;
+  }
+
+  inline char* data() noexcept {
+    return _flex ? _flex->data() : _inline;
+  }
+
+  inline const char* data() const noexcept {
+    return _flex ? _flex->data() : _inline;
+  }
+
+  char& operator[](size_t index) {
+    check_bounds(index, 1);
+    return data()[index];
+  }
+
+  const char& operator[](size_t index) const {
+    check_bounds(index, 1);
+    return data()[index];
+  }
+
+  /**
+   * View the current data without spilling. The view is invalidated when this buffer grows or moves.
+   */
+  operator std::span<char>() noexcept {
+    return std::span<char>{data(), size()};
+  }
+
+  operator std::span<const char>() const noexcept {
+    return std::span<const char>{data(), size()};
+  }
+
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  const T read(size_t index) const {
+    check_bounds(index, sizeof(T));
+    T result;
+    memcpy(&result, data() + index, sizeof(T));
+    return result;
+  }
+
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  void write(const T& src, size_t index = 0) {
+    check_bounds(index, sizeof(T));
+    memcpy(data() + index, &src, sizeof(T));
+  }
+
+  /**
+   * Fill the data with 0's to the current size.
+   */
+  void clear() noexcept {
+    memset(data(), 0, size());
+  }
+
+  /**
+   * Set the current size, spilling to the heap when it exceeds the inline capacity.
+   */
+  void resize(size_t size, ResizeMode mode = ResizeMode::KeepData) {
+    if (!_flex && size <= N) {
+      _size = size;
+      return;
+    }
+    spill(size);
+    _flex->resize(size, mode);
+  }
+
+  /**
+   * Spill to the heap if not already, and get the FlexBuffer holding the data.
+   */
+  FlexBuffer& flex() {
+    spill(_size);
+    return *_flex;
+  }
+
+  /**
+   * Get a Buffer that wraps the same underlying data for the given range, spilling to the heap so that it can
+   * outlive this object.
+   */
+  Buffer span(size_t index = 0, size_t size = npos) {
+    return flex().span(index, size);
+  }
+
+  /**
+   * Allocate a new Buffer consisting of the contents of this buffer for the given range.
+   */
+  Buffer copy(size_t index = 0, size_t size = npos) const {
+    if (size == npos)
+      size = this->size() - index;
+    check_bounds(index, size);
+    return Buffer::copy_of(data(), index, size);
+  }
+
+  /**
+   * Append the given buffer to the end, growing by the given buffer's size.
+   */
+  SmallFlexBuffer& operator<<(const Buffer& buffer) {
+    return append(buffer.data(), buffer.size());
+  }
+
+  /**
+   * Append the given string to the end, growing by the given string's size.
+   */
+  SmallFlexBuffer& operator<<(const std::string_view& string) {
+    return append(string.data(), string.size());
+  }
+
+  /**
+   * Append any fundamental type to the end, growing by the given type's size.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  SmallFlexBuffer& operator<<(const T& src) {
+    return append(reinterpret_cast<const char*>(&src), sizeof(T));
+  }
+
+  std::string str() const {
+    return std::string{data(), size()};
+  }
+
+  std::string hex() const {
+    return Buffer::wrap(data(), 0, size()).hex();
+  }
+
+private:
+  inline SmallFlexBuffer& append(const char* src, size_t size) {
+    if (!_flex) {
+      if (size <= N - _size) {
+        memcpy(_inline + _size, src, size);
+        _size += size;
+        return *this;
+      }
+      spill(_size + size);
+    }
+    auto offset = _flex->size();
+    _flex->resize(offset + size);
+    memcpy(_flex->data() + offset, src, size);
+    return *this;
+  }
+};
+
+/**
+ * A fixed-size buffer of N bytes held inside the object, for records whose size is known at compile time.
+ * It never allocates, and reads and writes at a compile-time offset are bounds checked by the compiler.
+ * Converts to a Buffer or std::span that wraps the same memory, which must not outlive this object.
+ * Pass-by-value will deep copy.
+ */
+template <size_t N>
+class FixedBuffer {
+private:
+  alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) std::array<char, N> _data{};
+
+  inline void check_bounds(size_t index, size_t size) const {
+    if (index > N || size > N - index)
+      throw std::range_error{"array index out of bounds"};
+  }
+
+public:
+  static const size_t npos = -1;
+
+  /**
+   * Create a buffer filled with 0's.
+   */
+  constexpr FixedBuffer() noexcept = default;
+
+  /**
+   * Get the buffer size.
+   */
+  static constexpr size_t size() noexcept {
+    return N;
+  }
+
+  inline char* data() noexcept {
+    return _data.data();
+  }
+
+  inline const char* data() const noexcept {
+    return _data.data();
+  }
+
+  /**
+   * Get the byte at the given index.
+   * Throws on array index out of bounds.
+   */
+  char& operator[](size_t index) {
+    check_bounds(index, 1);
+    return _data[index];
+  }
+
+  const char& operator[](size_t index) const {
+    check_bounds(index, 1);
+    return _data[index];
+  }
+
+  operator std::span<char, N>() noexcept {
+    return std::span<char, N>{_data};
+  }
+
+  operator std::span<const char, N>() const noexcept {
+    return std::span<const char, N>{_data};
+  }
+
+  /**
+   * Wrap this buffer's memory in a Buffer, e.g. for BufferReader and BufferWriter.
+   * Beware ownership: the returned Buffer and its spans must not outlive this object.
+   * Throws std::bad_alloc if the Buffer's header cannot be allocated.
+   */
+  operator Buffer() {
+    return Buffer::wrap(data(), 0, N);
+  }
+
+  operator const Buffer() const {
+    return Buffer::wrap(data(), 0, N);
+  }
+
+  /**
+   * Return a copy of any fundamental type from the given compile-time offset, without a runtime bounds check.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  const T read() const noexcept {
+    static_assert(Offset + sizeof(T) <= N, "array index out of bounds");
+    T v;
+    memcpy(&v, data() + Offset, sizeof(T));
+    return v;
+  }
+
+  /**
+   * Return a copy of any fundamental type from the given index.
+   * Throws on array index out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  const T read(size_t index) const {
+    check_bounds(index, sizeof(T));
+    T v;
+    memcpy(&v, data() + index, sizeof(T));
+    return v;
+  }
+
+  /**
+   * Write any fundamental type to the given compile-time offset, without a runtime bounds check.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  void write(const T& src) noexcept {
+    static_assert(Offset + sizeof(T) <= N, "array index out of bounds");
+    memcpy(data() + Offset, &src, sizeof(T));
+  }
+
+  /**
+   * Write any fundamental type to the given index.
+   * Throws on array index out of bounds.
+   */
+  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
+  void write(const T& src, size_t index = 0) {
+    check_bounds(index, sizeof(T));
+    memcpy(data() + index, &src, sizeof(T));
+  }
+
+  /**
+   * Return a copy of any arithmetic type stored in big-endian (network) order at the given compile-time offset.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  const T read_be() const noexcept {
+    return internal::convert_endian<std::endian::big>(read<T, Offset>());
+  }
+
+  /**
+   * Return a copy of any arithmetic type stored in little-endian order at the given compile-time offset.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  const T read_le() const noexcept {
+    return internal::convert_endian<std::endian::little>(read<T, Offset>());
+  }
+
+  /**
+   * Write any arithmetic type to the given compile-time offset in big-endian (network) order.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_be(const T& src) noexcept {
+    write<T, Offset>(internal::convert_endian<std::endian::big>(src));
+  }
+
+  /**
+   * Write any arithmetic type to the given compile-time offset in little-endian order.
+   */
+  template <typename T, size_t Offset, typename = std::enable_if_t<internal::is_swappable_v<T>>>
+  void write_le(const T& src) noexcept {
+    write<T, Offset>(internal::convert_endian<std::endian::little>(src));
+  }
+
+  /**
+   * Get a Buffer that wraps the same memory for the given range.
+   * Beware ownership: the returned Buffer must not outlive this object.
+   */
+  Buffer span(size_t index = 0, size_t size = npos) {
+    if (size == npos)
+      size = N - index;
+    check_bounds(index, size);
+    return Buffer::wrap(data(), index, size);
+  }
+
+  const Buffer span(size_t index = 0, size_t size = npos) const {
+    return const_cast<FixedBuffer&>(*this).span(index, size);
+  }
+
+  /**
+   * Allocate a new Buffer consisting of the contents of this buffer for the given range.
+   */
+  Buffer copy(size_t index = 0, size_t size = npos) const {
+    if (size == npos)
+      size = N - index;
+    check_bounds(index, size);
+    return Buffer::copy_of(data(), index, size);
+  }
+
+  /**
+   * Fill the data with 0's
+   */
+  void clear() noexcept {
+    _data.fill(0);
+  }
+
+  std::string str() const {
+    return std::string{data(), N};
+  }
+
+  std::string hex() const {
+    return Buffer::wrap(data(), 0, N).hex();
+  }
+};
+
+/**
+ * A growable buffer made of a chain of fixed-size segments.
+ * Growing appends a new segment instead of moving the existing data, so appending n bytes copies each byte once and
+ * never needs more than one spare segment. The data can be read across segment boundaries with a ChainReader,
+ * copied into one contiguous Buffer with linearize(), or written out with writev via iovecs().
+ * Pass-by-value will deep copy.
+ */
+class ChainBuffer {
+private:
+  size_t _segment_size;
+  std::pmr::memory_resource* _resource;
+  std::vector<Buffer> _segments;
+  size_t _size = 0;
+
+  /**
+   * Get the number of bytes used in the given segment.
+   */
+  inline size_t used(size_t segment) const noexcept {
+    return std::min(_segment_size, _size - segment * _segment_size);
+  }
+
+  ChainBuffer& append(const char* src, size_t size) {
+    while (size > 0) {
+      if (_size == _segments.size() * _segment_size)
+        _segments.push_back(Buffer::allocate(_segment_size, _resource));
+      auto offset = _size % _segment_size;
+      auto count = std::min(size, _segment_size - offset);
+      memcpy(_segments.back().raw_data() + offset, src, count);
+      _size += count;
+      src += count;
+      size -= count;
+    }
+    return *this;
+  }
+
+public:
+  static constexpr size_t default_segment_size = static_cast<size_t>(64) << 10;
+
+  /**
+   * Create an empty chain that allocates segments of the given size as it grows.
+   * Segments are allocated from the given memory resource (null for the global operator new), which must outlive
+   * this buffer and its spans.
+   */
+  explicit ChainBuffer(size_t segment_size = default_segment_size, std::pmr::memory_resource* resource = nullptr)
+      : _segment_size{segment_size}, _resource{resource} {
+    if (segment_size == 0)
+      throw std::invalid_argument{"segment size must be positive"};
+  }
+
+  ChainBuffer(const ChainBuffer& rhs) = default;
+  ChainBuffer& operator=(const ChainBuffer& rhs) = default;
+  /**
+   * Take the segments of the given chain, leaving it empty.
+   */
+  ChainBuffer(ChainBuffer&& rhs) noexcept
+      : _segment_size{rhs._segment_size},
+        _resource{rhs._resource},
+        _segments{std::move(rhs._segments)},
+        _size{std::exchange(rhs._size, 0)} {
+    rhs._segments.clear();
+  }
+
+  /**
+   * Take the segments of the given chain, leaving it empty.
+   */
+  ChainBuffer& operator=(ChainBuffer&& rhs) noexcept {
+    if (this != &rhs) {
+      _segment_size = rhs._segment_size;
+      _resource = rhs._resource;
+      _segments = std::move(rhs._segments);
+      _size = std::exchange(rhs._size, 0);
+      rhs._segments.clear();
+    }
+    return *this;
+  }
+
+  ~ChainBuffer() = default;
+
+  /**
+   * Get the total number of bytes appended.
+   */
+  inline size_t size() const noexcept {
+    return _size;
+  }
+
+  /**
+   * Get the size of each segment.
+   */
+  inline size_t segment_size() const noexcept {
+    return _segment_size;
+  }
+
+  /**
+   * Get the number of segments that hold data.
+   */
+  inline size_t segment_count() const noexcept {
+    return (_size + _segment_size - 1) / _segment_size;
+  }
+
+  /**
+   * Get a span of the used part of the given segment, which shares the segment's data and may outlive this buffer.
+   */
+  Buffer segment(size_t index) {
+    if (index >= segment_count())
+      throw std::range_error{"array index out of bounds"};
+    return _segments[index].span(0, used(index));
+  }
+
+  const Buffer segment(size_t index) const {
+    return const_cast<ChainBuffer&>(*this).segment(index);
+  }
+
+  /**
+   * Append the given buffer to the end, growing by the given buffer's size.
+   */
+  ChainBuffer& operator<<(const Buffer& buffer) {
+    return append(buffer.data(), buffer.size());
+  }
+
+  /**
+   * Append the given string to the end, growing by the given string's size.
+   */
+  ChainBuffer& operator<<(const std::string_view& string) {
+    return append(string.data(), string.size());
+  }
+
+  /**
+   * Append any fundamental type to the end, growing by the given type's size.
+   * A value may be split across two segments.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  ChainBuffer& operator<<(const T& src) {
+    return append(reinterpret_cast<const char*>(&src), sizeof(T));
+  }
+
+  /**
+   * Copy the given range into dest, which must have room for size bytes.
+   * Throws on array index out of bounds.
+   */
+  void copy_to(char* dest, size_t index, size_t size) const {
+    if (index > _size || size > _size - index)
+      throw std::range_error{"array index out of bounds"};
+    while (size > 0) {
+      auto segment = index / _segment_size;
+      auto offset = index % _segment_size;
+      auto count = std::min(size, _segment_size - offset);
+      memcpy(dest, _segments[segment].raw_data() + offset, count);
+      dest += count;
+      index += count;
+      size -= count;
+    }
+  }
+
+  /**
+   * Allocate a new contiguous Buffer holding all of the data.
+   */
+  Buffer linearize() const {
+    auto result = Buffer::allocate_uninitialized(_size);
+    copy_to(result.raw_data(), 0, _size);
+    return result;
+  }
+
+  /**
+   * Drop all segments and set the size to 0.
+   */
+  void reset() noexcept {
+    _segments.clear();
+    _size = 0;
+  }
+
+  std::string str() const {
+    std::string result(_size, '\0');
+    copy_to(result.data(), 0, _size);
+    return result;
+  }
+
+#if defined(__linux__)
+  /**
+   * Get an iovec for the used part of each segment, in order, e.g. for writev.
+   * The iovecs point into this buffer's segments and are invalidated by reset() or destruction.
+   */
+  std::vector<iovec> iovecs() const {
+    std::vector<iovec> result;
+    result.reserve(segment_count());
+    for (size_t i = 0; i < segment_count(); ++i)
+      result.push_back(iovec{const_cast<char*>(_segments[i].raw_data()), used(i)});
+    return result;
+  }
+#endif
+};
+
+/**
+ * Wraps a ChainBuffer to provide linear reads across segment boundaries by advancing a position.
+ * The reader shares the segments, so it stays valid when the ChainBuffer grows, resets or goes away,
+ * but only sees the data that had been appended when it was created.
+ */
+class ChainReader {
+private:
+  std::vector<Buffer> _segments;
+  size_t _segment_size;
+  size_t _size;
+  size_t _position = 0;
+
+  inline void check_bounds(size_t size) const {
+    if (size > remaining())
+      throw std::range_error{"array index out of bounds"};
+  }
+
+  void copy_to(char* dest, size_t size) const {
+    auto index = _position;
+    while (size > 0) {
+      auto offset = index % _segment_size;
+      auto count = std::min(size, _segment_size - offset);
+      memcpy(dest, _segments[index / _segment_size].data_unchecked() + offset, count);
+      dest += count;
+      index += count;
+      size -= count;
+    }
+  }
+
+public:
+  ChainReader() = delete;
+  ChainReader(const ChainBuffer& chain) : _segment_size{chain.segment_size()}, _size{chain.size()} {
+    _segments.reserve(chain.segment_count());
+    // share the segments rather than deep copying them, they are only ever read through this reader
+    for (size_t i = 0; i < chain.segment_count(); ++i)
+      _segments.push_back(const_cast<ChainBuffer&>(chain).segment(i));
+  }
+  ChainReader(const ChainReader&) = default;
+  ChainReader& operator=(const ChainReader&) = default;
+  ChainReader(ChainReader&&) = default;
+  ChainReader& operator=(ChainReader&&) = default;
+
+  /**
+   * Get the read position
+   */
+  size_t position() const noexcept {
+    return _position;
+  }
+
+  /**
+   * Set the read position.
+   */
+  void position(size_t position) noexcept {
+    _position = position;
+  }
+
+  /**
+   * Get the remaining bytes to be read.
+   */
+  size_t remaining() const noexcept {
+    return _position < _size ? _size - _position : 0;
+  }
+
+  /**
+   * Get the next "size" bytes from the current position.
+   * This is a span of the underlying segment when the range lies within one segment, and a copy otherwise.
+   * After creating the buffer, this Reader's position remains unchanged.
+   */
+  const Buffer peek(size_t size) const {
+    check_bounds(size);
+    if (size == 0)
+      return Buffer{};
+    auto offset = _position % _segment_size;
+    if (offset + size <= _segment_size)
+      return _segments[_position / _segment_size].span(offset, size);
+    auto result = Buffer::allocate_uninitialized(size);
+    copy_to(result.data_unchecked(), size);
+    return result;
+  }
+
+  /**
+   * Get a copy of any fundemental type from the current position.
+   * After reading the value, this Reader's position remains unchanged.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  T peek() const {
+    check_bounds(sizeof(T));
+    T result;
+    copy_to(reinterpret_cast<char*>(&result), sizeof(T));
+    return result;
+  }
+
+  /**
+   * Get the next "size" bytes from the current position, as for peek(size).
+   * After creating the buffer, this Reader's position is advanced by the size.
+   */
+  const Buffer next(size_t size) {
+    auto result = peek(size);
+    _position += size;
+    return result;
+  }
+
+  /**
+   * Get a copy of any fundemental type from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
+   */
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  T next() {
+    auto result = peek<T>();
+    _position += sizeof(T);
+    return result;
+  }
+
+  /**
+   * Get a copy of any arithmetic type stored in big-endian (network) order from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
+   */
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T next_be() {
+    return internal::convert_endian<std::endian::big>(next<T>());
+  }
+
+  /**
+   * Get a copy of any arithmetic type stored in little-endian order from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
+   */
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T next_le() {
+    return internal::convert_endian<std::endian::little>(next<T>());
+  }
+};
+
+#if defined(__linux__)
+/**
+ * A list of iovecs over Buffers for writev and readv, which keeps every added Buffer's data alive.
+ * After a partial write or read, advance() drops the transferred bytes, so the same list can be passed again
+ * to transfer the rest.
+ * The iovecs hold the address of each buffer's memory when it was added. A FlexBuffer that grows or shrinks
+ * afterwards may move its memory, leaving its iovec dangling, so it must not be resized while in the list.
+ */
+class IoVecList {
+private:
+  std::vector<Buffer> _buffers;
+  std::vector<iovec> _iovecs;
+  size_t _index = 0;
+  size_t _size = 0;
+
+public:
+  IoVecList() = default;
+
+  /**
+   * Create a list of the given Buffers, FlexBuffers or ChainBuffers, in order.
+   */
+  template <typename... Buffers>
+  explicit IoVecList(const Buffers&... buffers) {
+    (add(buffers), ...);
+  }
+
+  /**
+   * Append an iovec over the given buffer, sharing its underlying data rather than copying it.
+   */
+  IoVecList& add(const Buffer& buffer) {
+    if (buffer.size() == 0)
+      return *this;
+    _buffers.push_back(buffer.share());
+    _iovecs.push_back(iovec{_buffers.back().data_unchecked(), buffer.size()});
+    _size += buffer.size();
+    return *this;
+  }
+
+  /**
+   * Append an iovec over each segment of the given chain, sharing the segments rather than copying them.
+   */
+  IoVecList& add(const ChainBuffer& chain) {
+    for (size_t i = 0; i < chain.segment_count(); ++i)
+      add(chain.segment(i));
+    return *this;
+  }
+
+  /**
+   * Get the remaining iovecs, starting with any partially transferred one.
+   */
+  inline iovec* data() noexcept {
+    return _iovecs.data() + _index;
+  }
+
+  /**
+   * Get the number of remaining iovecs.
+   */
+  inline size_t count() const noexcept {
+    return _iovecs.size() - _index;
+  }
+
+  /**
+   * Get the number of remaining bytes.
+   */
+  inline size_t size() const noexcept {
+    return _size;
+  }
+
+  inline bool empty() const noexcept {
+    return _size == 0;
+  }
+
+  /**
+   * Drop the given number of transferred bytes from the front of the list.
+   */
+  void advance(size_t bytes) {
+    if (bytes > _size)
+      throw std::range_error{"array index out of bounds"};
+    _size -= bytes;
+    while (bytes > 0) {
+      auto& front = _iovecs[_index];
+      if (bytes < front.iov_len) {
+        front.iov_base = static_cast<char*>(front.iov_base) + bytes;
+        front.iov_len -= bytes;
+        return;
+      }
+      bytes -= front.iov_len;
+      ++_index;
+    }
+  }
+};
+
+namespace internal {
+/**
+ * Write or read the remaining iovecs of the given list with the given writev/readv, retrying on EINTR,
+ * until the list is empty, the call would block, or it transfers no bytes.
+ * Returns the number of bytes transferred. Throws std::system_error on any other error.
+ */
+template <typename Call>
+size_t transfer_iovecs(int fd, IoVecList& list, Call call) {
+  size_t total = 0;
+  while (!list.empty()) {
+    auto count = static_cast<int>(std::min(list.count(), static_cast<size_t>(IOV_MAX)));
+    auto result = call(fd, list.data(), count);
+    if (result < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      throw std::system_error{errno, std::generic_category()};
+    }
+    if (result == 0)
+      break;
+    list.advance(static_cast<size_t>(result));
+    total += static_cast<size_t>(result);
+  }
+  return total;
+}
+} // namespace internal
+
+/**
+ * Write the remaining bytes of the given list to the given file descriptor with writev, advancing the list.
+ * Partial writes are continued until the list is empty, or the file descriptor is non-blocking and would block.
+ * Returns the number of bytes written. Throws std::system_error on error.
+ */
+inline size_t write_to_fd(int fd, IoVecList& list) {
+  return internal::transfer_iovecs(fd, list, ::writev);
+}
+
+/**
+ * Write the given Buffers, FlexBuffers or ChainBuffers to the given file descriptor in order, in as few writev calls
+ * as possible. Returns the number of bytes written, which is less than their total size only when the file
+ * descriptor is non-blocking and would block. Throws std::system_error on error.
+ */
+template <typename... Buffers>
+size_t write_to_fd(int fd, const Buffers&... buffers) {
+  IoVecList list{buffers...};
+  return write_to_fd(fd, list);
+}
+
+/**
+ * Read from the given file descriptor into the remaining bytes of the given list with readv, advancing the list.
+ * Partial reads are continued until the list is full, the end of the file, or the file descriptor is non-blocking and
+ * would block. Returns the number of bytes read. Throws std::system_error on error.
+ */
+inline size_t read_into(int fd, IoVecList& list) {
+  return internal::transfer_iovecs(fd, list, ::readv);
+}
+
+/**
+ * Read up to max_size bytes from the given file descriptor with a single read(2), appending them to the given
+ * FlexBuffer. The FlexBuffer grows by the number of bytes read, keeping the capacity reserved for the read,
+ * whatever its shrink policy. Retries on EINTR.
+ * Like read(2), returns the number of bytes read, 0 at the end of the file, and -1 if the file descriptor is
+ * non-blocking and would block. Throws std::system_error on any other error.
+ */
+inline ssize_t read_into(int fd, FlexBuffer& dest, size_t max_size) {
+  auto offset = dest.size();
+  dest.reserve_capacity(offset + max_size);
+  ssize_t result;
+  do {
+    result = ::read(fd, dest.data_unchecked() + offset, max_size);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      return -1;
+    throw std::system_error{errno, std::generic_category()};
+  }
+  dest._size = offset + static_cast<size_t>(result);
+  return result;
+}
+
+/**
+ * Read from the given file descriptor into the spare capacity of the given FlexBuffer with a single read(2),
+ * first growing it according to its growth policy if it has none. Returns as read_into(fd, dest, max_size).
+ */
+inline ssize_t read_into(int fd, FlexBuffer& dest) {
+  if (dest.size() == dest.capacity())
+    dest.reserve_capacity(dest.size() + 1);
+  return read_into(fd, dest, dest.capacity() - dest.size());
+}
+#endif
+
+/**
+ * A thread-safe memory resource that recycles power-of-two size classes, and a factory for Buffers and FlexBuffers
+ * backed by it.
+ * Memory is returned to a free list local to the releasing thread when the last span of a Buffer drops,
+ * and FlexBuffer growth pulls the next size class from the same pool.
+ * Blocks larger than max_pooled_size, or with extended alignment, pass straight through to the upstream resource.
+ * Each Buffer takes a single block holding both its BufferData header and its payload. A FlexBuffer takes one block
+ * for its header and another for its payload, so the payload can grow and shrink through the size classes alone.
+ * The pool must outlive every buffer allocated from it, and the upstream resource must outlive the pool.
+ * Destroying the pool reclaims the blocks cached by every thread, not just the calling one.
+ */
+class BufferPool : public std::pmr::memory_resource {
+private:
+  static constexpr size_t min_class_shift = 4;
+  static constexpr size_t class_count = 64 - min_class_shift;
+  static constexpr size_t thread_cache_limit = 64; // cached blocks per size class per thread
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct FreeList {
+    FreeBlock* head = nullptr;
+    size_t count = 0;
+
+    void push(void* ptr) noexcept {
+      auto block = static_cast<FreeBlock*>(ptr);
+      block->next = head;
+      head = block;
+      ++count;
+    }
+
+    void* pop() noexcept {
+      auto block = head;
+      head = block->next;
+      --count;
+      return block;
+    }
+  };
+
+  struct ThreadCache;
+
+  /**
+   * Shared between the pool and every thread cache that holds its blocks, so cached blocks can always be returned.
+   * Tracks those caches so that destroying the pool can reclaim their blocks.
+   */
+  struct State {
+    std::pmr::memory_resource* upstream;
+    size_t max_pooled_size;
+    std::mutex mutex;
+    std::array<FreeList, class_count> lists;
+    std::vector<ThreadCache*> caches; // guarded by mutex
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+
+    State(std::pmr::memory_resource* upstream, size_t max_pooled_size)
+        : upstream{upstream}, max_pooled_size{max_pooled_size} {};
+    ~State() {
+      release();
+    }
+
+    /**
+     * Return every block in the shared free lists to the upstream resource.
+     */
+    void release() noexcept {
+      for (size_t index = 0; index < class_count; ++index) {
+        while (lists[index].head)
+          upstream->deallocate(lists[index].pop(), class_size(index), __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+      }
+    }
+  };
+
+  struct ThreadCache {
+    std::shared_ptr<State> state;
+    std::array<FreeList, class_count> lists;
+
+    /**
+     * Move every cached block to the shared free lists. The state's mutex must be held.
+     */
+    void drain() noexcept {
+      for (size_t index = 0; index < class_count; ++index) {
+        while (lists[index].head)
+          state->lists[index].push(lists[index].pop());
+      }
+    }
+
+    /**
+     * Stop tracking this cache in its state. The state's mutex must be held.
+     */
+    void unregister() noexcept {
+      auto& caches = state->caches;
+      caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+    }
+  };
+
+  /**
+   * Per-thread free lists of every pool used by this thread, returned to their pools when the thread exits.
+   */
+  struct ThreadCaches {
+    std::vector<std::unique_ptr<ThreadCache>> caches; // stable addresses, as their states point to them
+
+    ThreadCache& get(const std::shared_ptr<State>& state) {
+      for (auto& cache : caches) {
+        if (cache->state == state)
+          return *cache;
+      }
+      auto& cache = caches.emplace_back(std::make_unique<ThreadCache>(ThreadCache{state, {}}));
+      std::lock_guard<std::mutex> lock{state->mutex};
+      state->caches.push_back(cache.get());
+      return *cache;
+    }
+
+    void flush(ThreadCache& cache) noexcept {
+      std::lock_guard<std::mutex> lock{cache.state->mutex};
+      cache.drain();
+      cache.unregister();
+    }
+
+    void remove(const std::shared_ptr<State>& state) noexcept {
+      for (auto it = caches.begin(); it != caches.end(); ++it) {
+        if ((*it)->state == state) {
+          flush(**it);
+          caches.erase(it);
+          return;
+        }
+      }
+    }
+
+    ~ThreadCaches() {
+      for (auto& cache : caches)
+        flush(*cache);
+    }
+  };
+
+  std::shared_ptr<State> _state;
+
+  static ThreadCaches& thread_caches() {
+    static thread_local ThreadCaches caches;
+    return caches;
+  }
+
+  static size_t class_index(size_t bytes) noexcept {
+    auto width = bytes > 1 ? static_cast<size_t>(std::bit_width(bytes - 1)) : 0;
+    return width > min_class_shift ? width - min_class_shift : 0;
+  }
+
+  static size_t class_size(size_t index) noexcept {
+    return static_cast<size_t>(1) << (index + min_class_shift);
+  }
+
+  bool pooled(size_t bytes, size_t alignment) const noexcept {
+    return bytes != 0 && bytes <= _state->max_pooled_size && alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+  }
+
+protected:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    if (!pooled(bytes, alignment)) {
+      _state->misses.fetch_add(1, std::memory_order_relaxed);
+      return _state->upstream->allocate(bytes, alignment);
+    }
+    auto index = class_index(bytes);
+    auto& local = thread_caches().get(_state).lists[index];
+    if (local.head) {
+      _state->hits.fetch_add(1, std::memory_order_relaxed);
+      return local.pop();
+    }
+    {
+      std::lock_guard<std::mutex> lock{_state->mutex};
+      auto& shared = _state->lists[index];
+      if (shared.head) {
+        _state->hits.fetch_add(1, std::memory_order_relaxed);
+        return shared.pop();
+      }
+    }
+    _state->misses.fetch_add(1, std::memory_order_relaxed);
+    return _state->upstream->allocate(class_size(index), __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+    if (!pooled(bytes, alignment)) {
+      _state->upstream->deallocate(ptr, bytes, alignment);
+      return;
+    }
+    auto index = class_index(bytes);
+    auto& local = thread_caches().get(_state).lists[index];
+    if (local.count < thread_cache_limit) {
+      local.push(ptr);
+      return;
+    }
+    std::lock_guard<std::mutex> lock{_state->mutex};
+    _state->lists[index].push(ptr);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+public:
+  static constexpr size_t default_max_pooled_size = static_cast<size_t>(1) << 24;
+
+  /**
+   * Create a pool that draws new blocks of up to max_pooled_size bytes from the given upstream resource.
+   */
+  explicit BufferPool(size_t max_pooled_size = default_max_pooled_size,
+                      std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : _state{std::make_shared<State>(upstream, max_pooled_size)} {};
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  /**
+   * Return every cached block to the upstream resource, including those cached by other threads.
+   * No other thread may be using the pool.
+   */
+  ~BufferPool() {
+    thread_caches().remove(_state);
+    std::lock_guard<std::mutex> lock{_state->mutex};
+    for (auto cache : _state->caches)
+      cache->drain();
+    _state->release();
+  }
+
+  /**
+   * Get the power-of-two size class that an allocation of the given size is served from.
+   */
+  static size_t size_class(size_t size) noexcept {
+    return class_size(class_index(size));
+  }
+
+  /**
+   * Allocate a Buffer of the given size as a single block, with its header, in the matching size class.
+   */
+  Buffer buffer(size_t size) {
+    return Buffer{internal::allocate_buffer_data(size, this), 0, size};
+  }
+
+  /**
+   * Create an empty FlexBuffer, with its initial capacity rounded up to fill its size class.
+   * All growth of the FlexBuffer is served from this pool.
+   */
+  FlexBuffer flex_buffer(size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+    return FlexBuffer{size_class(initial_capacity), this};
+  }
+
+  /**
+   * Get the number of allocations served from a free list.
+   */
+  size_t hits() const noexcept {
+    return _state->hits.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Get the number of allocations that had to go to the upstream resource.
+   */
+  size_t misses() const noexcept {
+    return _state->misses.load(std::memory_order_relaxed);
+  }
+};
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+/**
+ * A completed IoUring operation.
+ * result is the number of bytes transferred, or -errno on failure.
+ * buffer is a span of the transferred bytes of the operation's buffer, which stays valid however long it is kept.
+ */
+struct IoCompletion {
+  uint64_t user_data;
+  int result;
+  Buffer buffer;
+};
+
+/**
+ * An io_uring submission and completion queue for reading into and writing from Buffers.
+ * Operations are queued without a syscall and submitted together by submit() or complete(), so many reads and
+ * writes cost one io_uring_enter. Every queued operation shares its Buffer's underlying data until it completes,
+ * so the memory stays valid even if the caller drops its own references, and pins it in place, so a FlexBuffer
+ * resize that would move it throws std::logic_error instead. Each operation is limited to 4 GiB.
+ * Buffers registered with register_buffers() are used with the fixed-buffer operations automatically,
+ * which saves the kernel mapping the pages on every operation.
+ * Not thread-safe. Throws std::system_error if io_uring is unavailable.
+ */
+class IoUring {
+private:
+  static constexpr uint64_t cancel_user_data = static_cast<uint64_t>(-1);
+
+  struct Slot {
+    std::optional<Buffer> buffer; // empty while the slot is free
+    uint64_t user_data = 0;
+  };
+
+  int _fd;
+  size_t _sq_ring_size;
+  size_t _cq_ring_size;
+  size_t _sqes_size;
+  char* _sq_ring;
+  char* _cq_ring;
+  io_uring_sqe* _sqes;
+  unsigned* _sq_head;
+  unsigned* _sq_tail;
+  unsigned* _sq_array;
+  unsigned _sq_mask;
+  unsigned _sq_entries;
+  unsigned* _cq_head;
+  unsigned* _cq_tail;
+  io_uring_cqe* _cqes;
+  unsigned _cq_mask;
+  unsigned _cq_entries;
+  size_t _pending = 0;
+  size_t _in_flight = 0;
+  std::vector<Slot> _slots;
+  std::vector<size_t> _free_slots;
+  std::vector<Buffer> _fixed;
+
+  static int enter(int fd, size_t to_submit, size_t min_complete, unsigned flags) {
+    int result;
+    do {
+      result = static_cast<int>(syscall(__NR_io_uring_enter, fd, static_cast<unsigned>(to_submit),
+                                        static_cast<unsigned>(min_complete), flags, nullptr, 0));
+    } while (result < 0 && errno == EINTR);
+    if (result < 0)
+      throw std::system_error{errno, std::generic_category(), "io_uring_enter"};
+    return result;
+  }
+
+  static char* map_ring(int fd, size_t size, off_t offset) {
+    auto ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (ring == MAP_FAILED)
+      throw std::system_error{errno, std::generic_category(), "io_uring mmap"};
+    return static_cast<char*>(ring);
+  }
+
+  void unmap() noexcept {
+    if (_sqes)
+      munmap(_sqes, _sqes_size);
+    if (_cq_ring && _cq_ring != _sq_ring)
+      munmap(_cq_ring, _cq_ring_size);
+    if (_sq_ring)
+      munmap(_sq_ring, _sq_ring_size);
+    ::close(_fd);
+  }
+
+  /**
+   * Get the next free submission queue entry, submitting the queue first if it is full.
+   */
+  io_uring_sqe* next_sqe() {
+    auto tail = *_sq_tail;
+    if (tail - std::atomic_ref<unsigned>{*_sq_head}.load(std::memory_order_acquire) == _sq_entries) {
+      submit();
+    }
+    auto index = tail & _sq_mask;
+    auto sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    _sq_array[index] = index;
+    return sqe;
+  }
+
+  void push_sqe() noexcept {
+    std::atomic_ref<unsigned>{*_sq_tail}.store(*_sq_tail + 1, std::memory_order_release);
+    ++_pending;
+  }
+
+  void queue(int fd, uint8_t opcode, uint8_t fixed_opcode, const Buffer& buffer, uint64_t user_data, uint64_t offset) {
+    // every completion needs room in the completion queue, which is never allowed to overflow, with one entry kept
+    // free so that the destructor can always queue a cancel. This also caps the pins on any one buffer below 65536
+    if (_in_flight + _pending + 1 >= _cq_entries)
+      throw std::runtime_error{"too many io_uring operations in flight"};
+    if (buffer.size() > UINT32_MAX)
+      throw std::length_error{"io_uring operations are limited to 4 GiB"};
+    auto sqe = next_sqe();
+    // make room for a free slot first, so nothing below can throw and leave a slot taken
+    if (_free_slots.empty()) {
+      _free_slots.reserve(_slots.size() + 1);
+      _slots.emplace_back();
+      _free_slots.push_back(_slots.size() - 1);
+    }
+    auto slot = _free_slots.back();
+    _free_slots.pop_back();
+    _slots[slot].buffer = buffer.share();
+    _slots[slot].buffer->_data->pin();
+    _slots[slot].user_data = user_data;
+    auto fixed = fixed_index(buffer);
+    sqe->opcode = fixed < _fixed.size() ? fixed_opcode : opcode;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uintptr_t>(_slots[slot].buffer->data_unchecked());
+    sqe->len = static_cast<unsigned>(buffer.size());
+    if (fixed < _fixed.size())
+      sqe->buf_index = static_cast<uint16_t>(fixed);
+    sqe->user_data = slot;
+    push_sqe();
+  }
+
+  /**
+   * Get the index of the registered buffer sharing the given buffer's data, or _fixed.size() if there is none.
+   */
+  size_t fixed_index(const Buffer& buffer) const noexcept {
+    for (size_t i = 0; i < _fixed.size(); ++i) {
+      if (_fixed[i]._data.get() == buffer._data.get())
+        return i;
+    }
+    return _fixed.size();
+  }
+
+  /**
+   * Abandon the ring and every buffer the kernel may still use, leaking them rather than freeing memory that
+   * operations still in flight could write into.
+   */
+  void abandon() noexcept {
+    for (auto& slot : _slots) {
+      if (slot.buffer)
+        slot.buffer->_data.leak();
+    }
+    for (auto& fixed : _fixed)
+      fixed._data.leak();
+  }
+
+public:
+  /**
+   * Use the current file position for reads and writes, as for read(2) and write(2). Pipes and sockets require it.
+   */
+  static constexpr uint64_t current_position = static_cast<uint64_t>(-1);
+
+  /**
+   * Create a ring with room for the given number of queued operations.
+   */
+  explicit IoUring(unsigned entries = 256) : _sq_ring{nullptr}, _cq_ring{nullptr}, _sqes{nullptr} {
+    io_uring_params params{};
+    _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (_fd < 0)
+      throw std::system_error{errno, std::generic_category(), "io_uring_setup"};
+    try {
+      _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+        _sq_ring = _cq_ring = map_ring(_fd, _sq_ring_size, IORING_OFF_SQ_RING);
+      } else {
+        _sq_ring = map_ring(_fd, _sq_ring_size, IORING_OFF_SQ_RING);
+        _cq_ring = map_ring(_fd, _cq_ring_size, IORING_OFF_CQ_RING);
+      }
+      _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+      _sqes = reinterpret_cast<io_uring_sqe*>(map_ring(_fd, _sqes_size, IORING_OFF_SQES));
+    } catch (...) {
+      unmap();
+      throw;
+    }
+    _sq_head = reinterpret_cast<unsigned*>(_sq_ring + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(_sq_ring + params.sq_off.tail);
+    _sq_array = reinterpret_cast<unsigned*>(_sq_ring + params.sq_off.array);
+    _sq_mask = *reinterpret_cast<unsigned*>(_sq_ring + params.sq_off.ring_mask);
+    _sq_entries = params.sq_entries;
+    _cq_head = reinterpret_cast<unsigned*>(_cq_ring + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(_cq_ring + params.cq_off.tail);
+    _cqes = reinterpret_cast<io_uring_cqe*>(_cq_ring + params.cq_off.cqes);
+    _cq_mask = *reinterpret_cast<unsigned*>(_cq_ring + params.cq_off.ring_mask);
+    _cq_entries = params.cq_entries;
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+  IoUring(IoUring&&) = delete;
+  IoUring& operator=(IoUring&&) = delete;
+
+  /**
+   * Cancel the operations still in flight and wait for them to finish, since the kernel may write into their
+   * buffers until they do. If the ring fails first, its mappings, file descriptor and those buffers are leaked.
+   */
+  ~IoUring() {
+    try {
+      std::vector<IoCompletion> discarded;
+      size_t next = 0;
+      while (next < _slots.size() || _in_flight + _pending > 0) {
+        // cancel as many operations as the completion queue has room for, then reap to make room for the rest
+        for (; next < _slots.size() && _pending + _in_flight < _cq_entries; ++next) {
+          if (!_slots[next].buffer)
+            continue;
+          auto sqe = next_sqe();
+          sqe->opcode = IORING_OP_ASYNC_CANCEL;
+          sqe->fd = -1;
+          sqe->addr = next;
+          sqe->user_data = cancel_user_data;
+          push_sqe();
+        }
+        if (_in_flight + _pending > 0)
+          complete(discarded, 1);
+        discarded.clear();
+      }
+    } catch (...) {
+      // the ring is unusable, so the remaining operations can neither be cancelled nor waited for
+      abandon();
+      return;
+    }
+    unmap();
+  }
+
+  /**
+   * Queue a read from the given file descriptor into the given buffer, e.g. the result of FlexBuffer::reserve.
+   * The completion holds a span of the bytes read. Until its reads complete, a FlexBuffer resize that would move its
+   * memory throws std::logic_error, since the kernel holds the address. Afterwards, resize away any reserved bytes
+   * not read. Throws std::length_error if the buffer is larger than 4 GiB.
+   */
+  void read(int fd, const Buffer& target, uint64_t user_data = 0, uint64_t offset = current_position) {
+    queue(fd, IORING_OP_READ, IORING_OP_READ_FIXED, target, user_data, offset);
+  }
+
+  /**
+   * Queue a write of the given buffer to the given file descriptor.
+   * As for write(2), fewer bytes than the buffer's size may be written, in which case the rest must be queued again.
+   * Throws std::length_error if the buffer is larger than 4 GiB.
+   */
+  void write(int fd, const Buffer& source, uint64_t user_data = 0, uint64_t offset = current_position) {
+    queue(fd, IORING_OP_WRITE, IORING_OP_WRITE_FIXED, source, user_data, offset);
+  }
+
+  /**
+   * Allocate the given number of buffers of the given size, from the given pool if not null, and register them with
+   * the kernel as fixed buffers. Reads and writes on spans of them use the fixed-buffer operations.
+   * The pool must outlive this ring.
+   * Buffers can only be registered once per ring. Throws std::system_error on failure.
+   */
+  void register_buffers(size_t count, size_t size, BufferPool* pool = nullptr) {
+    if (!_fixed.empty())
+      throw std::runtime_error{"io_uring buffers are already registered"};
+    std::vector<Buffer> fixed;
+    std::vector<iovec> iovecs;
+    for (size_t i = 0; i < count; ++i) {
+      fixed.push_back(pool ? pool->buffer(size) : Buffer::allocate(size));
+      iovecs.push_back(iovec{fixed.back().data_unchecked(), size});
+    }
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, iovecs.data(),
+                static_cast<unsigned>(iovecs.size())) < 0)
+      throw std::system_error{errno, std::generic_category(), "io_uring_register"};
+    _fixed = std::move(fixed);
+  }
+
+  /**
+   * Get a span of a registered buffer that is not referenced anywhere else, or nullopt if all of them are in use.
+   * The buffer is returned to the free set once the returned span, its own spans and any completions holding it
+   * are all gone.
+   */
+  std::optional<Buffer> fixed_buffer() {
+    for (auto& fixed : _fixed) {
+      if (fixed._data.use_count() == 1)
+        return fixed.span();
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * Get the number of operations queued but not yet submitted.
+   */
+  size_t pending() const noexcept {
+    return _pending;
+  }
+
+  /**
+   * Get the number of operations submitted but not yet completed.
+   */
+  size_t in_flight() const noexcept {
+    return _in_flight;
+  }
+
+  /**
+   * Submit all queued operations with a single io_uring_enter, returning the number submitted.
+   */
+  size_t submit() {
+    if (_pending == 0)
+      return 0;
+    auto submitted = static_cast<size_t>(enter(_fd, _pending, 0, 0));
+    _pending -= submitted;
+    _in_flight += submitted;
+    return submitted;
+  }
+
+  /**
+   * Submit any queued operations, wait until at least min_complete operations have completed (capped at the number
+   * in flight), and append every available completion to dest. Returns the number of completions appended.
+   */
+  size_t complete(std::vector<IoCompletion>& dest, size_t min_complete = 0) {
+    min_complete = std::min(min_complete, _in_flight + _pending);
+    if (_pending > 0 || min_complete > 0) {
+      auto submitted = static_cast<size_t>(
+          enter(_fd, _pending, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0));
+      _pending -= submitted;
+      _in_flight += submitted;
+    }
+    size_t count = 0;
+    auto head = *_cq_head;
+    auto tail = std::atomic_ref<unsigned>{*_cq_tail}.load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      auto& cqe = _cqes[head & _cq_mask];
+      --_in_flight;
+      if (cqe.user_data == cancel_user_data)
+        continue;
+      auto& slot = _slots[cqe.user_data];
+      auto size = cqe.res > 0 ? static_cast<size_t>(cqe.res) : 0;
+      slot.buffer->_data->unpin();
+      dest.push_back(IoCompletion{slot.user_data, cqe.res, slot.buffer->span(0, size)});
+      slot.buffer.reset();
+      _free_slots.push_back(cqe.user_data);
+      ++count;
+    }
+    std::atomic_ref<unsigned>{*_cq_head}.store(head, std::memory_order_release);
+    return count;
+  }
+};
+#endif
+
+class BufferReader {
+private:
+  const Buffer _span;
+  size_t _position = 0;
+
+public:
+  BufferReader() = delete;
+  BufferReader(const Buffer& buffer) : _span(buffer.span()){};
+  BufferReader(const BufferReader&) = default;
+  BufferReader& operator=(const BufferReader&) = default;
+  BufferReader(BufferReader&&) = default;
+  BufferReader& operator=(BufferReader&&) = default;
+
+  /**
+   * Get the read position
+   */
+  size_t position() const noexcept {
+    return _position;
+  }
+
+  /**
+   * Set the read position.
+   */
+  void position(size_t position) noexcept {
+    _position = position;
+  }
+
+  /**
+   * Get the remaining bytes to be read.
+   */
+  size_t remaining() const noexcept {
+    return _position < _span.size() ? _span.size() - _position : 0;
+  }
+
+  /**
+   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
+   * After creating the span, this Reader's position remains unchanged.
+   */
+  const Buffer peek(size_t size) const {
+    return _span.span(_position, size);
   }
 
   /**
-   * Wrap the given span.
-   * Beware ownership: you must ensure the span's underlying data remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   * Get a copy of any fundemental type from the underlying Buffer from the current position.
+   * After reading the value, this Reader's position remains unchanged.
    */
   template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer wrap(const std::span<T>& span) {
-    auto data = reinterpret_cast<char*>(span.data());
-    auto size = span.size() * sizeof(T);
-    return Buffer{std::make_shared<BufferData>(data, 0, size), 0, size};
+  T peek() const {
+    return _span.read<T>(_position);
   }
 
   /**
-   * Wrap the given span.
-   * Beware ownership: you must ensure the span's underlying data remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
+   * After creating the span, this Reader's position is advanced by the size.
    */
-  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static const Buffer wrap(const std::span<const T, N>& span) {
-    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
-    size_t size = span.size() * sizeof(T);
-    return Buffer{std::make_shared<BufferData>(data, 0, size), 0, size};
+  const Buffer next(size_t size) {
+    Buffer result = _span.span(_position, size);
+    _position += size;
+    return result;
   }
 
   /**
-   * Wrap the given span.
-   * Beware ownership: you must ensure the span's underlying data remains valid.
-   * Consider wrap(std::shared_ptr<const char[]> data, size_t offset, size_t size) for safety if possible.
+   * Get a copy of any fundemental type from the underlying Buffer from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
    */
-  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer wrap(const std::span<T, N>& span) {
-    auto data = reinterpret_cast<char*>(span.data());
-    size_t size = span.size() * sizeof(T);
-    return Buffer{std::make_shared<BufferData>(data, 0, size), 0, size};
-  }
-
-  static Buffer allocate(size_t size) {
-    return Buffer{std::make_shared<BufferData>(size), 0, size};
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  T next() {
+    auto result = _span.read<T>(_position);
+    _position += sizeof(T);
+    return result;
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given data into it.
+   * Throw unless the next "size" bytes from the current position can be read.
+   * After a successful check, up to "size" bytes may be read with the unchecked accessors.
    */
-  static Buffer copy_of(const char* data, size_t offset, size_t size) {
-    auto buffer = Buffer::allocate(size);
-    memcpy(buffer.raw_data(), reinterpret_cast<const char*>(data + offset), size);
-    return buffer;
+  void ensure(size_t size) const {
+    _span.check(_position, size);
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given string into it.
+   * Get a copy of any fundemental type from the current position without bounds checking, and advance the position.
+   * Behavior is undefined unless the read is covered by a preceding ensure().
    */
-  static Buffer copy_of(const std::string& string) {
-    return copy_of(string.data(), 0, string.size());
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  T next_unchecked() noexcept {
+    auto result = _span.read_unchecked<T>(_position);
+    _position += sizeof(T);
+    return result;
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given string_view into it.
+   * Get a copy of any fundemental type from the current position without bounds checking.
+   * Behavior is undefined unless the read is covered by a preceding ensure().
    */
-  static Buffer copy_of(const std::string_view& string) {
-    return copy_of(string.data(), 0, string.size());
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  T peek_unchecked() const noexcept {
+    return _span.read_unchecked<T>(_position);
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given span into it.
+   * Get a copy of any arithmetic type stored in big-endian (network) order from the current position.
+   * After reading the value, this Reader's position remains unchanged.
    */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer copy_of(const std::span<const T>& span) {
-    auto data = const_cast<char*>(reinterpret_cast<const char*>(span.data()));
-    auto size = span.size() * sizeof(T);
-    return copy_of(data, 0, size);
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T peek_be() const {
+    return _span.read_be<T>(_position);
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given span into it.
+   * Get a copy of any arithmetic type stored in little-endian order from the current position.
+   * After reading the value, this Reader's position remains unchanged.
    */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer copy_of(const std::span<T>& span) {
-    auto data = reinterpret_cast<char*>(span.data());
-    size_t size = span.size() * sizeof(T);
-    return copy_of(data, 0, size);
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T peek_le() const {
+    return _span.read_le<T>(_position);
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given span into it.
+   * Get a copy of any arithmetic type stored in big-endian (network) order from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
    */
-  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer copy_of(const std::span<const T, N>& span) {
-    auto data = reinterpret_cast<const char*>(span.data());
-    size_t size = span.size() * sizeof(T);
-    return copy_of(data, 0, size);
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T next_be() {
+    return internal::convert_endian<std::endian::big>(next<T>());
   }
 
   /**
-   * Allocate a new Buffer and copy the contents of the given span into it.
+   * Get a copy of any arithmetic type stored in little-endian order from the current position.
+   * After reading the value, this Reader's position is advanced by the size.
    */
-  template <typename T, size_t N, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  static Buffer copy_of(const std::span<T, N>& span) {
-    auto data = reinterpret_cast<char*>(span.data());
-    size_t size = span.size() * sizeof(T);
-    return copy_of(data, 0, size);
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  T next_le() {
+    return internal::convert_endian<std::endian::little>(next<T>());
   }
+};
+
+class BufferWriter {
+private:
+  Buffer _span;
+  size_t _position = 0;
+
+public:
+  BufferWriter() = delete;
+  BufferWriter(Buffer& buffer) : _span(buffer.span()){};
+  BufferWriter(Buffer&& buffer) : _span(std::move(buffer)){};
+  BufferWriter(const BufferWriter&) = delete;
+  BufferWriter& operator=(const BufferWriter&) = delete;
+  BufferWriter(BufferWriter&) = default;
+  BufferWriter& operator=(BufferWriter&) = default;
+  BufferWriter(BufferWriter&&) = default;
+  BufferWriter& operator=(BufferWriter&&) = default;
 
   /**
-   * Allocate a new Buffer and copy the contents of the given Buffer into it.
+   * Get the write position
    */
-  static Buffer copy_of(const Buffer& buffer_span) {
-    return copy_of(buffer_span.data(), 0, buffer_span.size());
+  size_t position() const noexcept {
+    return _position;
   }
 
   /**
-   * Create a buffer with size=0 and set underlying data to nullptr
+   * Set the write position.
    */
-  Buffer() : _data{std::make_shared<BufferData>()}, _offset{0}, _size{0} {};
+  void position(size_t position) noexcept {
+    _position = position;
+  }
 
   /**
-   * Deep copy
+   * Get the remaining bytes that may be written before overflowing the buffer.
    */
-  Buffer(const Buffer& rhs) : Buffer{std::make_shared<BufferData>(rhs.size()), 0, rhs.size()} {
-    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+  size_t remaining() const noexcept {
+    return _position < _span.size() ? _span.size() - _position : 0;
   }
 
   /**
-   * Deep copy
+   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
+   * After creating the span, this Reader's position remains unchanged.
    */
-  Buffer& operator=(const Buffer& rhs) {
-    _data = std::make_shared<BufferData>(rhs.size());
-    _size = rhs._size;
-    memcpy(raw_data(), rhs.raw_data(), rhs.size());
-    return *this;
+  Buffer peek(size_t size) {
+    return _span.span(_position, size);
   }
 
-  Buffer(Buffer&& rhs) = default;
-  Buffer& operator=(Buffer&& rhs) = default;
-  ~Buffer() = default;
-
   /**
-   * Get the buffer size.
+   * Get a span of the next "size" bytes of the underlying Bufer from the current position.
+   * After creating the span, this Reader's position is advanced by the size.
    */
-  inline size_t size() const noexcept {
-    return _size;
+  Buffer next(size_t size) {
+    Buffer result = _span.span(_position, size);
+    _position += size;
+    return result;
   }
 
   /**
-   * Get the raw pointer to the start of the underlying data.
+   * Write the given buffer at the current position, advancing the position by given buffer's size.
    */
-  inline char* data() {
-    check_bounds(0, 0);
-    return raw_data();
+  BufferWriter& operator<<(const Buffer& buffer) {
+    return write(buffer.data(), 0, buffer.size());
   }
 
   /**
-   * Get the raw pointer to the start of the underlying data.
+   * Write the given string at the current position, advancing the position by the given string's size.
    */
-  inline const char* data() const {
-    return const_cast<Buffer&>(*this).data();
+  BufferWriter& operator<<(const std::string_view& string) {
+    return write(string.data(), 0, string.size());
   }
 
   /**
-   * Get the byte at the given index.
-   * Throws on array index out of bounds.
+   * Write the given fundamental type's value at the current position, advancing the offset by the given type's size.
    */
-  char& operator[](size_t index) {
-    check_bounds(index, 1);
-    return raw_data()[index];
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  BufferWriter& operator<<(const T& src) {
+    if (_position + sizeof(T) > _span.size())
+      throw std::runtime_error{"array index out of bounds"};
+    memcpy(reinterpret_cast<char*>(_span.data() + _position), &src, sizeof(T));
+    _position += sizeof(T);
+    return *this;
   }
 
   /**
-   * Get the byte at the given index.
-   * Throws on array index out of bounds.
+   * Write the given arithmetic value in big-endian (network) order at the current position,
+   * advancing the position by the given type's size.
    */
-  const char& operator[](size_t index) const {
-    return const_cast<Buffer&>(*this)[index];
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  BufferWriter& write_be(const T& src) {
+    return *this << internal::convert_endian<std::endian::big>(src);
   }
 
   /**
-   * Convert this Buffer to a std::span
+   * Write the given arithmetic value in little-endian order at the current position,
+   * advancing the position by the given type's size.
    */
-  operator std::span<char>() {
-    check_bounds(0, size());
-    return std::span{raw_data(), size()};
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  BufferWriter& write_le(const T& src) {
+    return *this << internal::convert_endian<std::endian::little>(src);
+  }
+
+private:
+  inline BufferWriter& write(const char* src, size_t offset, size_t size) {
+    if (_position + size > _span.size())
+      throw std::runtime_error{"array index out of bounds"};
+    memcpy(reinterpret_cast<char*>(_span.data() + _position), reinterpret_cast<const char*>(src + offset), size);
+    _position += size;
+    return *this;
   }
+};
+
+/**
+ * Wraps a FlexBuffer to provide linear writes that grow the buffer as needed, according to its growth policy.
+ * Writing starts at the end of the buffer. The position can be moved back to overwrite earlier data, e.g. to
+ * backpatch a length prefix once the body is written, and writing past the end extends the buffer.
+ * Each write checks only against the capacity, which grows in chunks, so most writes never reallocate.
+ * The FlexBuffer must outlive the writer and must not be resized through other means while the writer is in use.
+ */
+class FlexBufferWriter {
+private:
+  FlexBuffer& _buffer;
+  size_t _position;
 
   /**
-   * Convert this Buffer to a std::span
+   * Make room for the given number of bytes at the current position and advance past them, extending the buffer's
+   * size if needed. Returns a pointer to the room.
    */
-  operator std::span<const char>() const {
-    check_bounds(0, size());
-    return std::span{raw_data(), size()};
+  inline char* advance(size_t size) {
+    auto end = _position + size;
+    if (end > _buffer.capacity())
+      _buffer.reserve_capacity(end);
+    auto dest = _buffer.data_unchecked() + _position;
+    _position = end;
+    if (end > _buffer._size)
+      _buffer._size = end;
+    return dest;
   }
 
+public:
+  FlexBufferWriter() = delete;
+  explicit FlexBufferWriter(FlexBuffer& buffer) : _buffer{buffer}, _position{buffer.size()} {};
+  FlexBufferWriter(const FlexBufferWriter&) = delete;
+  FlexBufferWriter& operator=(const FlexBufferWriter&) = delete;
+
   /**
-   * Return a copy of any fundamental type from the given index.
+   * Get the write position
    */
-  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
-  const T read(size_t index) const {
-    check_bounds(index, sizeof(T));
-    T v;
-    memcpy(&v, reinterpret_cast<const char*>(raw_data() + index), sizeof(T));
-    return v;
+  size_t position() const noexcept {
+    return _position;
   }
 
   /**
-   * Return a reference to any fundamental type from the given index which is backed by the array
+   * Set the write position, up to the buffer's size.
+   * Throws on array index out of bounds.
    */
-  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
-  const T& ref(size_t index) const {
-    check_bounds(index, sizeof(T));
-    return *reinterpret_cast<const T*>(reinterpret_cast<const char*>(raw_data() + index));
+  void position(size_t position) {
+    if (position > _buffer.size())
+      throw std::range_error{"array index out of bounds"};
+    _position = position;
   }
 
   /**
-   * Return a reference to any fundamental type from the given index which is backed by the array
+   * Move the write position to the end of the buffer.
    */
-  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
-  T& ref(size_t index) {
-    check_bounds(index, sizeof(T));
-    return *reinterpret_cast<T*>(reinterpret_cast<char*>(raw_data() + index));
+  void seek_end() noexcept {
+    _position = _buffer.size();
   }
 
   /**
-   * Write any fundamental type to the given index.
+   * Grow the buffer's capacity so that the given number of bytes can be written from the current position without
+   * reallocating.
    */
-  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
-  void write(const T& src, size_t index = 0) {
-    check_bounds(index, sizeof(T));
-    memcpy(reinterpret_cast<char*>(raw_data() + index), &src, sizeof(T));
+  void reserve(size_t size) {
+    _buffer.reserve_capacity(_position + size);
   }
 
   /**
-   * Write a span of any fundamental type to the given index.
+   * Drop everything written from the given size onward, e.g. a partially written message, keeping the capacity for
+   * later writes. Never reallocates or throws. The position moves back to the new end if it was past it.
    */
-  template <typename T, typename = std::enable_if_t<std::is_fundamental_v<T>>>
-  void write(const std::span<T>& src, size_t index = 0) {
-    check_bounds(index, sizeof(T) * src.size());
-    memcpy(reinterpret_cast<char*>(raw_data() + index), src.data(), sizeof(T) * src.size());
+  void truncate(size_t size) noexcept {
+    if (size < _buffer._size)
+      _buffer._size = size;
+    _position = std::min(_position, _buffer._size);
   }
 
   /**
-   * Write a buffer to the given index.
+   * Get a span of the next "size" bytes from the current position, growing the buffer if needed,
+   * e.g. to fill in later. After creating the span, this Writer's position is advanced by the size.
+   * The span stays valid as the buffer grows.
    */
-  void write(const Buffer& src, size_t index = 0) {
-    check_bounds(index, src.size());
-    memcpy(reinterpret_cast<char*>(raw_data() + index), src.data(), src.size());
+  Buffer next(size_t size) {
+    auto offset = _position;
+    advance(size);
+    return _buffer.span(offset, size);
   }
 
   /**
-   * Write a buffer to the given index.
+   * Write the given buffer at the current position, advancing the position by given buffer's size.
    */
-  void write(const Buffer&& src, size_t index = 0) {
-    write(src, index);
+  FlexBufferWriter& operator<<(const Buffer& buffer) {
+    return write(buffer.data(), buffer.size());
   }
 
   /**
-   * Get a mutable buffer span that wraps the same underlying data for the given range.
-   * The returned buffer span may outlive the source buffer span.
+   * Write the given string at the current position, advancing the position by the given string's size.
    */
-  Buffer span(size_t index = 0, size_t size = Buffer::npos) {
-    if (size == Buffer::npos)
-      size = _size - index;
-    check_bounds(index, size);
-    return Buffer{_data, _offset + index, size};
+  FlexBufferWriter& operator<<(const std::string_view& string) {
+    return write(string.data(), string.size());
   }
 
   /**
-   * Get a const buffer span that wraps the same underlying data for the given range.
-   * The returned buffer span may outlive the source buffer span.
+   * Write the given fundamental type's value at the current position, advancing the offset by the given type's size.
    */
-  const Buffer span(size_t index = 0, size_t size = Buffer::npos) const {
-    return const_cast<Buffer&>(*this).span(index, size);
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  FlexBufferWriter& operator<<(const T& src) {
+    memcpy(advance(sizeof(T)), &src, sizeof(T));
+    return *this;
   }
 
   /**
-   * Create a copy Buffer of part of the underlying data
+   * Write the given arithmetic value in big-endian (network) order at the current position,
+   * advancing the position by the given type's size.
    */
-  Buffer copy(size_t index = 0, size_t size = Buffer::npos) const {
-    if (size == Buffer::npos)
-      size = _size - index;
-    check_bounds(index, size);
-    auto result = Buffer::allocate(size);
-    memcpy(result.raw_data(), reinterpret_cast<const char*>(raw_data() + index), size);
-    return result;
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  FlexBufferWriter& write_be(const T& src) {
+    return *this << internal::convert_endian<std::endian::big>(src);
+  }
+
+  /**
+   * Write the given arithmetic value in little-endian order at the current position,
+   * advancing the position by the given type's size.
+   */
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  FlexBufferWriter& write_le(const T& src) {
+    return *this << internal::convert_endian<std::endian::little>(src);
   }
 
   /**
-   * Fill the data with 0's
+   * Overwrite any fundamental type at the given index of already written data, without moving the position.
+   * Throws on array index out of bounds.
    */
-  void clear() {
-    check_bounds(0, _size);
-    memset(raw_data(), 0, _size);
+  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
+  void patch(size_t index, const T& src) {
+    _buffer.write<T>(src, index);
   }
 
   /**
-   * Convert the contents to a std::string
+   * Overwrite any arithmetic type at the given index of already written data in big-endian (network) order.
    */
-  std::string str() const {
-    check_bounds(0, _size);
-    return std::string{raw_data(), 0, _size};
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  void patch_be(size_t index, const T& src) {
+    _buffer.write_be<T>(src, index);
   }
 
   /**
-   * Convert the contents to a hex string
+   * Overwrite any arithmetic type at the given index of already written data in little-endian order.
    */
-  std::string hex() const {
-    check_bounds(0, _size);
-    std::ostringstream oss;
-    oss << "0x";
-    oss << std::hex << std::setfill('0');
-    for (size_t i = 0; i < _size; ++i)
-      oss << std::setw(2) << static_cast<int>(raw_data()[i]);
-    return oss.str();
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  void patch_le(size_t index, const T& src) {
+    _buffer.write_le<T>(src, index);
+  }
+
+private:
+  inline FlexBufferWriter& write(const char* src, size_t size) {
+    memcpy(advance(size), src, size);
+    return *this;
   }
 };
 
 /**
- * A buffer that always allocates its own memory, can be resized, and can continuously grow to fit more data.
- * Pass-by-value semantics will deep copy the underlying data - O(n).
- * The default constructor allocates an initial capacity of the system's byte-alignment length and sets the size to 0.
- * The size will automatically double and halve as necessary as the buffer is resized or data is appended.
- * This class extends Buffer.
+ * Builds nested length-prefixed frames in a FlexBuffer in a single pass.
+ * Beginning a frame reserves room for its length prefix, and ending it writes the length of everything appended
+ * since, so nested messages need no temporary buffers. Varint prefixes reserve a fixed width and are written
+ * padded to it, which any LEB128 decoder accepts.
+ * Frames are ended innermost first, either explicitly with end() or by the Frame scope returned from frame().
  */
-class FlexBuffer : public Buffer {
+class FrameBuilder {
 private:
-  size_t _initial_capacity;
-  FlexBuffer(size_t initial_capacity, size_t allocate_size)
-      : Buffer{std::make_shared<BufferData>(allocate_size), 0, 0}, _initial_capacity{initial_capacity} {};
+  struct Open {
+    size_t prefix;
+    LengthPrefix format;
+  };
 
-  static size_t capacity_for(const size_t size, const size_t min_capacity) {
-    auto capacity = std::max(static_cast<size_t>(1), min_capacity);
-    while (size > capacity && capacity != 0) {
-      capacity <<= 1;
+  FlexBuffer& _buffer;
+  FlexBufferWriter _writer;
+  LengthPrefix _format;
+  size_t _varint_width;
+  std::vector<Open> _open;
+
+public:
+  /**
+   * Ends its frame, and any frames begun inside it, when it goes out of scope.
+   * Since a destructor cannot report errors, a frame that is too long for its prefix is instead removed from the
+   * buffer. Call end() on the scope to have that throw.
+   * A scope destroyed by an exception unwinding past it removes its frame too, rather than giving a partly written
+   * message a valid length.
+   */
+  class Frame {
+  private:
+    FrameBuilder* _builder;
+    size_t _depth;
+    int _exceptions;
+
+  public:
+    Frame(FrameBuilder& builder, size_t depth) noexcept
+        : _builder{&builder}, _depth{depth}, _exceptions{std::uncaught_exceptions()} {};
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+    Frame(Frame&& rhs) noexcept
+        : _builder{std::exchange(rhs._builder, nullptr)}, _depth{rhs._depth}, _exceptions{rhs._exceptions} {};
+    Frame& operator=(Frame&&) = delete;
+
+    ~Frame() {
+      if (_builder)
+        _builder->end_to(_depth, std::uncaught_exceptions() > _exceptions);
     }
-    if (capacity == 0) {
-      // capacity can no longer double on architecture, set capacity to size
-      capacity = size;
+
+    /**
+     * End this frame now, which must be the innermost one.
+     * Throws like FrameBuilder::end().
+     */
+    void end() {
+      if (!_builder)
+        throw std::logic_error{"frame already ended"};
+      if (_builder->depth() != _depth + 1)
+        throw std::logic_error{"frames must be ended innermost first"};
+      // only let go once ended, so a frame too long for its prefix is still removed by the destructor
+      _builder->end();
+      _builder = nullptr;
     }
-    return capacity;
-  }
+  };
 
-public:
   /**
-   * Sets size=0 and pre-allocates a buffer to the given initial_capacity,
-   * which defaults to the system's byte-alignment size.
+   * Build frames at the end of the given buffer, with the given default prefix format.
+   * Varint prefixes reserve varint_width bytes, which bounds the length to 7 * varint_width bits.
    */
-  FlexBuffer(size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
-      : FlexBuffer{initial_capacity, initial_capacity} {};
+  explicit FrameBuilder(FlexBuffer& buffer, LengthPrefix format = LengthPrefix::Uint32BE, size_t varint_width = 5)
+      : _buffer{buffer}, _writer{buffer}, _format{format}, _varint_width{varint_width} {
+    if (varint_width == 0 || varint_width > internal::max_varint_width)
+      throw std::invalid_argument{"varint width must be between 1 and 10"};
+  }
+
+  FrameBuilder(const FrameBuilder&) = delete;
+  FrameBuilder& operator=(const FrameBuilder&) = delete;
 
   /**
-   * Deep copy
+   * Get the writer that appends frame contents, e.g. for fetching spans to fill in later.
    */
-  FlexBuffer(const FlexBuffer& rhs) : FlexBuffer{rhs._initial_capacity, rhs.capacity()} {
-    memcpy(raw_data(), rhs.raw_data(), rhs.size());
+  FlexBufferWriter& writer() noexcept {
+    return _writer;
   }
 
   /**
-   * Deep copy
+   * Get the number of frames that have begun and not ended.
    */
-  FlexBuffer& operator=(const FlexBuffer& rhs) {
-    _data = std::make_shared<BufferData>(rhs.capacity());
-    _size = rhs._size;
-    _initial_capacity = rhs._initial_capacity;
-    memcpy(raw_data(), rhs.raw_data(), rhs.size());
-    return *this;
+  size_t depth() const noexcept {
+    return _open.size();
   }
 
   /**
-   * Move
+   * Begin a frame with the default prefix format, reserving room for its length prefix.
    */
-  FlexBuffer(FlexBuffer&& rhs)
-      : Buffer{std::move(rhs._data), rhs._offset, rhs._size}, _initial_capacity(rhs._initial_capacity) {
-    rhs._offset = 0;
-    rhs._size = 0;
+  void begin() {
+    begin(_format);
   }
 
   /**
-   * Move
+   * Begin a frame with the given prefix format, reserving room for its length prefix.
    */
-  FlexBuffer& operator=(FlexBuffer&& rhs) {
-    _data = std::move(rhs._data);
-    _offset = rhs._offset;
-    _size = rhs._size;
-    _initial_capacity = rhs._initial_capacity;
-    rhs._offset = 0;
-    rhs._size = 0;
-    return *this;
+  void begin(LengthPrefix format) {
+    _writer.seek_end();
+    _open.push_back(Open{_buffer.size(), format});
+    _writer.next(width(format));
   }
-  ~FlexBuffer() = default;
 
   /**
-   * Get the initial capacity.
-   * The underlying memory will never reallocate smaller than this size.
+   * End the innermost frame, writing the number of bytes appended since it began into its prefix.
+   * Throws std::length_error if the length does not fit the prefix, leaving the frame open,
+   * and std::logic_error if no frame is open.
    */
-  inline size_t initial_capacity() const noexcept {
-    return _initial_capacity;
+  void end() {
+    if (_open.empty())
+      throw std::logic_error{"no frame to end"};
+    if (!patch(_open.back()))
+      throw std::length_error{"frame too long for its length prefix"};
+    _open.pop_back();
+    _writer.seek_end();
   }
 
   /**
-   * Get the current capacity of this buffer.
-   * This represents the maximum this buffer can be resized without undergoing a reallocation and copy.
+   * Begin a frame with the default prefix format, which ends when the returned scope goes away.
    */
-  inline size_t capacity() const noexcept {
-    return _data->capacity();
+  Frame frame() {
+    return frame(_format);
   }
 
   /**
-   * Clear the entirety of the underlying allocated memory.
+   * Begin a frame with the given prefix format, which ends when the returned scope goes away.
    */
-  inline void clear_all() noexcept {
-    memset(_data->data(), 0, _data->capacity());
+  Frame frame(LengthPrefix format) {
+    begin(format);
+    return Frame{*this, _open.size() - 1};
   }
 
   /**
-   * Allocate a new FlexBuffer consisting of the contents of this buffer for the given range.
+   * Append any Buffer, string or fundamental type to the current frame.
    */
-  inline FlexBuffer flex_copy(size_t index = 0, size_t size = FlexBuffer::npos) const {
-    if (size == FlexBuffer::npos)
-      size = _size - index;
-    check_bounds(index, size);
-    auto allocate_size = capacity_for(size, _initial_capacity);
-    FlexBuffer result{_initial_capacity, allocate_size};
-    result.append(raw_data(), index, size);
-    return result;
+  template <typename T>
+  FrameBuilder& operator<<(const T& src) {
+    _writer << src;
+    return *this;
+  }
+
+private:
+  size_t width(LengthPrefix format) const noexcept {
+    return format == LengthPrefix::Varint ? _varint_width : internal::prefix_width(format);
   }
 
   /**
-   * Set the current size, and grow or shrink the underlying memory by factors of two as necessary.
-   * By default all data through the current size is copied.
-   * Optionally, setting mode=ResizeMode::IgnoreData can disable the copy behavior.
+   * Write the length of the given frame into its prefix, or return false if it does not fit.
    */
-  void resize(size_t size, ResizeMode mode = ResizeMode::KeepData) noexcept {
-    auto new_capacity = size > _size ? capacity_for(size, _data->capacity()) : capacity_for(size, _initial_capacity);
-    if (new_capacity != _data->capacity()) {
-      _data->resize(mode, new_capacity);
+  bool patch(const Open& open) {
+    auto prefix_width = width(open.format);
+    auto length = _buffer.size() - open.prefix - prefix_width;
+    if (length > internal::max_prefix_length(open.format, _varint_width))
+      return false;
+    switch (open.format) {
+    case LengthPrefix::Uint16BE:
+      _writer.patch_be(open.prefix, static_cast<uint16_t>(length));
+      break;
+    case LengthPrefix::Uint16LE:
+      _writer.patch_le(open.prefix, static_cast<uint16_t>(length));
+      break;
+    case LengthPrefix::Uint32BE:
+      _writer.patch_be(open.prefix, static_cast<uint32_t>(length));
+      break;
+    case LengthPrefix::Uint32LE:
+      _writer.patch_le(open.prefix, static_cast<uint32_t>(length));
+      break;
+    case LengthPrefix::Varint:
+      internal::encode_varint(_buffer.data() + open.prefix, length, prefix_width);
+      break;
     }
-    _size = size;
+    return true;
   }
 
   /**
-   * Increment the total size by the given size, and return a writable Buffer that wraps this new memory.
+   * End frames down to the given depth without throwing, removing any frame whose length does not fit its prefix,
+   * or every one of them if discard is set.
    */
-  inline Buffer reserve(size_t size) noexcept {
-    auto offset = _size;
-    resize(_size + size);
-    return Buffer{_data, offset, size};
+  void end_to(size_t depth, bool discard) noexcept {
+    while (_open.size() > depth) {
+      if (discard || !patch(_open.back()))
+        _writer.truncate(_open.back().prefix);
+      _open.pop_back();
+    }
+    _writer.seek_end();
+  }
+};
+
+/**
+ * A reader over a stream of bytes that arrive over time, for writing protocol parsers as coroutines.
+ * A producer, e.g. a socket pump, appends to the reader with << or through buffer() followed by notify(),
+ * and a single consumer coroutine awaits next(size) or next<T>(), which suspend until enough bytes have arrived.
+ * The consumer resumes inline on the producer's call, and runs until it awaits more data than is available.
+ * Data is held in one contiguous FlexBuffer, so next(size) always returns a zero-copy span. Consumed bytes are
+ * compacted away lazily when the producer appends, copying only the unread tail, and never under a live span.
+ */
+class AsyncBufferReader {
+private:
+  FlexBuffer _buffer;
+  size_t _position = 0;
+  size_t _needed = 0;
+  std::coroutine_handle<> _waiter;
+  bool _closed = false;
+
+  bool ready(size_t size) const noexcept {
+    return _closed || available() >= size;
+  }
+
+  void wait(std::coroutine_handle<> waiter, size_t size) noexcept {
+    _waiter = waiter;
+    _needed = size;
+  }
+
+  void check(size_t size) const {
+    if (available() < size)
+      throw std::runtime_error{"end of stream"};
+  }
+
+  Buffer take(size_t size) {
+    check(size);
+    auto result = _buffer.span(_position, size);
+    _position += size;
+    return result;
+  }
+
+  template <typename T>
+  T take() {
+    check(sizeof(T));
+    auto result = _buffer.read_unchecked<T>(_position);
+    _position += sizeof(T);
+    return result;
   }
 
   /**
-   * Append the given buffer to the end of this FlexBuffer, growing by the given buffer's size.
+   * Drop the consumed bytes once they are at least half of the buffer, moving the unread tail to the front.
    */
-  FlexBuffer& operator<<(const Buffer& buffer) noexcept {
-    return append(buffer.data(), 0, buffer.size());
+  void compact() {
+    if (_buffer.compact_front(_position))
+      _position = 0;
   }
 
+public:
   /**
-   * Append the given string to the end of this FlexBuffer, growing by the given string's size.
+   * Awaitable for the next "size" bytes as a span of the underlying data.
    */
-  FlexBuffer& operator<<(const std::string_view& string) noexcept {
-    return append(string.data(), 0, string.size());
-  }
+  class NextBuffer {
+  private:
+    AsyncBufferReader& _reader;
+    size_t _size;
+
+  public:
+    NextBuffer(AsyncBufferReader& reader, size_t size) noexcept : _reader{reader}, _size{size} {};
+
+    bool await_ready() const noexcept {
+      return _reader.ready(_size);
+    }
+
+    void await_suspend(std::coroutine_handle<> waiter) noexcept {
+      _reader.wait(waiter, _size);
+    }
+
+    Buffer await_resume() {
+      return _reader.take(_size);
+    }
+  };
 
   /**
-   * Append any fundamental type to the end of this FlexBuffer, growing by the given type's size.
+   * Awaitable for a copy of the next value of any fundamental type, stored in the given byte order.
    */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  FlexBuffer& operator<<(const T& src) {
-    auto dest = reserve(sizeof(T));
-    memcpy(dest.data(), &src, sizeof(T));
-    return *this;
+  template <typename T, std::endian Order = std::endian::native>
+  class NextValue {
+  private:
+    AsyncBufferReader& _reader;
+
+  public:
+    explicit NextValue(AsyncBufferReader& reader) noexcept : _reader{reader} {};
+
+    bool await_ready() const noexcept {
+      return _reader.ready(sizeof(T));
+    }
+
+    void await_suspend(std::coroutine_handle<> waiter) noexcept {
+      _reader.wait(waiter, sizeof(T));
+    }
+
+    T await_resume() {
+      if constexpr (Order == std::endian::native)
+        return _reader.take<T>();
+      else
+        return internal::convert_endian<Order>(_reader.take<T>());
+    }
+  };
+
+  explicit AsyncBufferReader(size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__) : _buffer{initial_capacity} {};
+  AsyncBufferReader(const AsyncBufferReader&) = delete;
+  AsyncBufferReader& operator=(const AsyncBufferReader&) = delete;
+
+  /**
+   * Get the number of bytes that have arrived but not been read.
+   */
+  size_t available() const noexcept {
+    return _buffer.size() - _position;
   }
 
-private:
-  inline FlexBuffer& append(const char* src, size_t offset, size_t size) noexcept {
-    auto dest = reserve(size);
-    memcpy(dest.data(), reinterpret_cast<const char*>(src + offset), size);
-    return *this;
+  /**
+   * Check whether the producer has ended the stream.
+   */
+  bool closed() const noexcept {
+    return _closed;
   }
-};
 
-class BufferReader {
-private:
-  const Buffer _span;
-  size_t _position = 0;
+  /**
+   * Get the FlexBuffer that unread bytes are appended to, e.g. for read_into(fd, reader.buffer(), size).
+   * Call notify() after appending. Bytes before the unread data must not be modified.
+   */
+  FlexBuffer& buffer() {
+    compact();
+    return _buffer;
+  }
 
-public:
-  BufferReader() = delete;
-  BufferReader(const Buffer& buffer) : _span(buffer.span()){};
-  BufferReader(const BufferReader&) = default;
-  BufferReader& operator=(const BufferReader&) = default;
-  BufferReader(BufferReader&&) = default;
-  BufferReader& operator=(BufferReader&&) = default;
+  /**
+   * Resume the waiting consumer if enough bytes have arrived, or the stream has ended.
+   */
+  void notify() {
+    if (_waiter && ready(_needed))
+      std::exchange(_waiter, nullptr).resume();
+  }
 
   /**
-   * Get the read position
+   * End the stream, resuming the waiting consumer. Awaiting more bytes than are available then throws.
    */
-  size_t position() const noexcept {
-    return _position;
+  void close() {
+    _closed = true;
+    notify();
   }
 
   /**
-   * Set the read position.
+   * Append the given buffer and resume the consumer if it now has enough bytes.
    */
-  void position(size_t position) noexcept {
-    _position = position;
+  AsyncBufferReader& operator<<(const Buffer& buffer) {
+    this->buffer() << buffer;
+    notify();
+    return *this;
   }
 
   /**
-   * Get the remaining bytes to be read.
+   * Append the given string and resume the consumer if it now has enough bytes.
    */
-  size_t remaining() const noexcept {
-    return _position < _span.size() ? _span.size() - _position : 0;
+  AsyncBufferReader& operator<<(const std::string_view& string) {
+    buffer() << string;
+    notify();
+    return *this;
   }
 
   /**
-   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
-   * After creating the span, this Reader's position remains unchanged.
+   * Await the next "size" bytes, suspending until they have arrived. The result is a span of the underlying data.
+   * Throws std::runtime_error if the stream ends first.
    */
-  const Buffer peek(size_t size) const {
-    return _span.span(_position, size);
+  NextBuffer next(size_t size) noexcept {
+    return NextBuffer{*this, size};
   }
 
   /**
-   * Get a copy of any fundemental type from the underlying Buffer from the current position.
-   * After reading the value, this Reader's position remains unchanged.
+   * Await a copy of the next value of any fundamental type, suspending until it has arrived.
+   * Throws std::runtime_error if the stream ends first.
    */
   template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  T peek() const {
-    return _span.read<T>(_position);
+  NextValue<T> next() noexcept {
+    return NextValue<T>{*this};
   }
 
   /**
-   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
-   * After creating the span, this Reader's position is advanced by the size.
+   * Await a copy of the next arithmetic value stored in big-endian (network) order.
    */
-  const Buffer next(size_t size) {
-    Buffer result = _span.span(_position, size);
-    _position += size;
-    return result;
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  NextValue<T, std::endian::big> next_be() noexcept {
+    return NextValue<T, std::endian::big>{*this};
   }
 
   /**
-   * Get a copy of any fundemental type from the underlying Buffer from the current position.
-   * After reading the value, this Reader's position is advanced by the size.
+   * Await a copy of the next arithmetic value stored in little-endian order.
    */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  T next() {
-    auto result = _span.read<T>(_position);
-    _position += sizeof(T);
-    return result;
+  template <typename T, typename = typename std::enable_if_t<internal::is_swappable_v<T>>>
+  NextValue<T, std::endian::little> next_le() noexcept {
+    return NextValue<T, std::endian::little>{*this};
   }
 };
 
-class BufferWriter {
+/**
+ * Splits a stream of length-prefixed frames that arrives in arbitrary chunks.
+ * Chunks are appended to an internal FlexBuffer, and each complete frame is handed out as a span of that buffer,
+ * so frames are never copied. Only the partial frame left at the tail is moved when the consumed bytes are dropped,
+ * which happens lazily once they are at least half of the buffer.
+ * Frames stay valid after more chunks arrive, as spans keep the data they were taken from.
+ */
+class FrameDecoder {
 private:
-  Buffer _span;
+  FlexBuffer _buffer;
   size_t _position = 0;
+  LengthPrefix _format;
+  size_t _max_frame_size;
 
-public:
-  BufferWriter() = delete;
-  BufferWriter(Buffer& buffer) : _span(buffer.span()){};
-  BufferWriter(const BufferWriter&) = delete;
-  BufferWriter& operator=(const BufferWriter&) = delete;
-  BufferWriter(BufferWriter&) = default;
-  BufferWriter& operator=(BufferWriter&) = default;
-  BufferWriter(BufferWriter&&) = default;
-  BufferWriter& operator=(BufferWriter&&) = default;
+  template <typename T, std::endian Order>
+  uint64_t take_length() const noexcept {
+    return internal::convert_endian<Order>(_buffer.read_unchecked<T>(_position));
+  }
 
   /**
-   * Get the write position
+   * Decode the length prefix at the current position, returning its width, or 0 if it has not fully arrived.
    */
-  size_t position() const noexcept {
-    return _position;
+  size_t decode_prefix(uint64_t& length) const {
+    auto width = internal::prefix_width(_format);
+    if (_format == LengthPrefix::Varint)
+      return internal::decode_varint(_buffer.data_unchecked() + _position, available(), length);
+    if (available() < width)
+      return 0;
+    switch (_format) {
+    case LengthPrefix::Uint16BE:
+      length = take_length<uint16_t, std::endian::big>();
+      break;
+    case LengthPrefix::Uint16LE:
+      length = take_length<uint16_t, std::endian::little>();
+      break;
+    case LengthPrefix::Uint32BE:
+      length = take_length<uint32_t, std::endian::big>();
+      break;
+    case LengthPrefix::Uint32LE:
+      length = take_length<uint32_t, std::endian::little>();
+      break;
+    case LengthPrefix::Varint:
+      break;
+    }
+    return width;
   }
 
   /**
-   * Set the write position.
+   * Drop the consumed bytes once they are at least half of the buffer, moving the partial tail to the front.
    */
-  void position(size_t position) noexcept {
-    _position = position;
+  void compact() {
+    if (_buffer.compact_front(_position))
+      _position = 0;
   }
 
+public:
   /**
-   * Get the remaining bytes that may be written before overflowing the buffer.
+   * Decode frames with the given length prefix format, rejecting frames longer than max_frame_size.
    */
-  size_t remaining() const noexcept {
-    return _position < _span.size() ? _span.size() - _position : 0;
-  }
+  explicit FrameDecoder(LengthPrefix format = LengthPrefix::Uint32BE, size_t max_frame_size = 16 << 20,
+                        size_t initial_capacity = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      : _buffer{initial_capacity}, _format{format}, _max_frame_size{max_frame_size} {};
+  FrameDecoder(const FrameDecoder&) = delete;
+  FrameDecoder& operator=(const FrameDecoder&) = delete;
 
   /**
-   * Get a span of the next "size" bytes of the underlying Buffer from the current position.
-   * After creating the span, this Reader's position remains unchanged.
+   * Get the number of bytes that have arrived but not been decoded into frames.
    */
-  Buffer peek(size_t size) {
-    return _span.span(_position, size);
+  size_t available() const noexcept {
+    return _buffer.size() - _position;
   }
 
   /**
-   * Get a span of the next "size" bytes of the underlying Bufer from the current position.
-   * After creating the span, this Reader's position is advanced by the size.
+   * Get the largest frame size that is accepted.
    */
-  Buffer next(size_t size) {
-    Buffer result = _span.span(_position, size);
-    _position += size;
-    return result;
+  size_t max_frame_size() const noexcept {
+    return _max_frame_size;
   }
 
   /**
-   * Write the given buffer at the current position, advancing the position by given buffer's size.
+   * Get the FlexBuffer that chunks are appended to, e.g. for read_into(fd, decoder.buffer(), size).
+   * Bytes before the undecoded data must not be modified.
    */
-  BufferWriter& operator<<(const Buffer& buffer) {
-    return write(buffer.data(), 0, buffer.size());
+  FlexBuffer& buffer() {
+    compact();
+    return _buffer;
   }
 
   /**
-   * Write the given string at the current position, advancing the position by the given string's size.
+   * Append the given chunk of the stream.
    */
-  BufferWriter& operator<<(const std::string_view& string) {
-    return write(string.data(), 0, string.size());
+  FrameDecoder& operator<<(const Buffer& buffer) {
+    this->buffer() << buffer;
+    return *this;
   }
 
   /**
-   * Write the given fundamental type's value at the current position, advancing the offset by the given type's size.
+   * Append the given chunk of the stream.
    */
-  template <typename T, typename = typename std::enable_if_t<std::is_fundamental_v<T>>>
-  BufferWriter& operator<<(const T& src) {
-    if (_position + sizeof(T) > _span.size())
-      throw std::runtime_error{"array index out of bounds"};
-    memcpy(reinterpret_cast<char*>(_span.data() + _position), &src, sizeof(T));
-    _position += sizeof(T);
+  FrameDecoder& operator<<(const std::string_view& string) {
+    buffer() << string;
     return *this;
   }
 
-private:
-  inline BufferWriter& write(const char* src, size_t offset, size_t size) {
-    if (_position + size > _span.size())
-      throw std::runtime_error{"array index out of bounds"};
-    memcpy(reinterpret_cast<char*>(_span.data() + _position), reinterpret_cast<const char*>(src + offset), size);
-    _position += size;
-    return *this;
+  /**
+   * Get the next complete frame, without its prefix, as a span of the underlying data,
+   * or nothing if it has not fully arrived.
+   * Throws std::length_error if the frame is longer than max_frame_size, as soon as its prefix arrives,
+   * and std::runtime_error on a malformed varint prefix. The stream cannot be decoded further after either.
+   */
+  std::optional<Buffer> next() {
+    uint64_t length = 0;
+    auto width = decode_prefix(length);
+    if (width == 0)
+      return std::nullopt;
+    if (length > _max_frame_size)
+      throw std::length_error{"frame exceeds maximum size"};
+    if (available() - width < length)
+      return std::nullopt;
+    auto frame = _buffer.span(_position + width, static_cast<size_t>(length));
+    _position += width + static_cast<size_t>(length);
+    return frame;
   }
 };
 
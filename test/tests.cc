@@ -1,9 +1,60 @@
 #define CATCH_CONFIG_MAIN
 #include "catch2/catch.hpp"
 #include "flexbuf/flexbuf.h"
+#include <map>
+#include <sstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace flexbuf;
 
+namespace {
+class CountingResource : public std::pmr::memory_resource {
+public:
+  size_t allocations = 0;
+  size_t deallocations = 0;
+  size_t live_bytes = 0;
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++allocations;
+    live_bytes += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    ++deallocations;
+    live_bytes -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+#if defined(__linux__)
+size_t resident_pages(const char* data, size_t size) {
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> pages((size + page - 1) / page);
+  mincore(const_cast<char*>(data), size, pages.data());
+  size_t resident = 0;
+  for (auto p : pages)
+    resident += p & 1;
+  return resident;
+}
+#endif
+} // namespace
+
 TEST_CASE("Buffer::wrap(shared_ptr<char[]>)") {
   std::shared_ptr<char[]> src{new char[5]};
   src[0] = 'a';
@@ -101,6 +152,47 @@ TEST_CASE("Buffer.read<>()") {
   REQUIRE(buf.read<uint16_t>(1) == static_cast<uint16_t>(257));
 }
 
+TEST_CASE("Buffer::allocate() aligned and shared by spans") {
+  auto buf = std::make_shared<Buffer>(Buffer::allocate(12));
+  REQUIRE(reinterpret_cast<uintptr_t>(buf->data()) % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0);
+  buf->write(Buffer::wrap(std::string{"hello world!"}));
+  auto span = buf->span(6);
+  buf.reset();
+  REQUIRE(span.str() == "world!");
+}
+
+TEST_CASE("Buffer::allocate(size, resource)") {
+  CountingResource resource;
+  {
+    auto buf = Buffer::allocate(8, &resource);
+    REQUIRE(buf.resource() == &resource);
+    REQUIRE(resource.allocations == 1);
+    buf.write<uint64_t>(12345);
+    Buffer copy1{buf};
+    auto copy2 = buf.copy(4);
+    REQUIRE(copy1.resource() == &resource);
+    REQUIRE(copy2.resource() == &resource);
+    REQUIRE(copy1.read<uint64_t>(0) == 12345);
+    REQUIRE(resource.allocations == 3);
+  }
+  REQUIRE(resource.deallocations == 3);
+  REQUIRE(Buffer::allocate(8).resource() == std::pmr::new_delete_resource());
+}
+
+TEST_CASE("Buffer::allocate_uninitialized()") {
+  auto small = Buffer::allocate_uninitialized(16);
+  REQUIRE(small.size() == 16);
+  auto buf = Buffer::allocate_uninitialized(4 << 20);
+  REQUIRE(buf.size() == 4 << 20);
+#if defined(__linux__)
+  REQUIRE(resident_pages(buf.data(), buf.size()) == 0);
+#endif
+  buf.write<uint32_t>(12345, (4 << 20) - 4);
+  REQUIRE(buf.read<uint32_t>((4 << 20) - 4) == 12345);
+  buf.clear();
+  REQUIRE(buf.read<uint32_t>((4 << 20) - 4) == 0);
+}
+
 TEST_CASE("Buffer.span()") {
   std::string src{"hello world!"};
   auto buf = Buffer::wrap(src);
@@ -129,6 +221,50 @@ TEST_CASE("Buffer.hex()") {
   REQUIRE(oss.str() == "0x01070a21");
 }
 
+TEST_CASE("Buffer.hex() all bytes") {
+  auto buf = Buffer::allocate(256 + 3);
+  for (size_t i = 0; i < buf.size(); ++i)
+    buf[i] = static_cast<char>(i);
+  std::string expected = "0x";
+  for (size_t i = 0; i < buf.size(); ++i) {
+    static const char* digits = "0123456789abcdef";
+    expected += digits[(i >> 4) & 0x0f];
+    expected += digits[i & 0x0f];
+  }
+  REQUIRE(buf.hex() == expected);
+  REQUIRE(buf.span(1, 2).hex() == "0x0102");
+  REQUIRE(Buffer::wrap(std::string{"\xff\x80"}).hex() == "0xff80");
+  REQUIRE(Buffer{}.hex() == "0x");
+}
+
+TEST_CASE("Buffer.hex(dest)") {
+  auto buf = Buffer::copy_of(std::string{"\x01\xab"});
+  std::string str{"packet: "};
+  REQUIRE(buf.hex(str) == "packet: 0x01ab");
+  auto dest = Buffer::allocate(8);
+  dest.clear();
+  buf.hex(dest, 2);
+  REQUIRE(dest.str() == std::string{"\0\0" "0x01ab"});
+  REQUIRE_THROWS(buf.hex(dest, 3), "array index out of bounds");
+}
+
+TEST_CASE("Buffer::from_hex()") {
+  auto buf = Buffer::allocate(100);
+  for (size_t i = 0; i < buf.size(); ++i)
+    buf[i] = static_cast<char>(i * 7);
+  auto decoded = Buffer::from_hex(buf.hex());
+  REQUIRE(decoded.str() == buf.str());
+  std::string upper = buf.hex().substr(2);
+  for (auto& c : upper)
+    c = static_cast<char>(toupper(c));
+  REQUIRE(Buffer::from_hex(upper).str() == buf.str());
+  REQUIRE(Buffer::from_hex("").size() == 0);
+  REQUIRE_THROWS_AS(Buffer::from_hex("0x123"), std::invalid_argument);
+  REQUIRE_THROWS_AS(Buffer::from_hex("0x0g"), std::invalid_argument);
+  REQUIRE_THROWS_AS(Buffer::from_hex(std::string(31, '0') + "/" + std::string(32, '0')), std::invalid_argument);
+  REQUIRE_THROWS_AS(Buffer::from_hex(std::string(31, '0') + "G"), std::invalid_argument);
+}
+
 TEST_CASE("Buffer.span() of span") {
   std::shared_ptr<char[]> src{new char[4]};
   src[0] = 1;
@@ -262,6 +398,87 @@ TEST_CASE("Buffer.ref<>()") {
   REQUIRE(buf.read<uint32_t>(4) == 22222);
 }
 
+TEST_CASE("Buffer unchecked accessors") {
+  auto buf = Buffer::allocate(8);
+  buf.check(0, 8);
+  REQUIRE_THROWS(buf.check(4, 5), "array index out of bounds");
+  buf.write_unchecked<uint32_t>(12345, 0);
+  buf.ref_unchecked<uint32_t>(4) = 67890;
+  REQUIRE(buf.read_unchecked<uint32_t>(0) == 12345);
+  REQUIRE(buf.read<uint32_t>(4) == 67890);
+  buf.at_unchecked(0) = 'a';
+  REQUIRE(buf[0] == 'a');
+  REQUIRE(buf.data_unchecked() == buf.data());
+}
+
+TEST_CASE("Buffer.read_be<>() and write_be<>()") {
+  auto buf = Buffer::allocate(16);
+  buf.write_be<uint32_t>(0x01020304, 0);
+  REQUIRE(buf.hex().substr(0, 10) == "0x01020304");
+  REQUIRE(buf.read_be<uint32_t>(0) == 0x01020304);
+  buf.write_le<uint16_t>(0x0102, 4);
+  REQUIRE(buf[4] == 0x02);
+  REQUIRE(buf.read_le<uint16_t>(4) == 0x0102);
+  buf.write_be<double>(1.5, 8);
+  REQUIRE(buf[8] == 0x3f);
+  REQUIRE(buf.read_be<double>(8) == 1.5);
+  REQUIRE_THROWS(buf.read_be<uint64_t>(9), "array index out of bounds");
+}
+
+TEST_CASE("Buffer.read_be<>(span) and write_be<>(span) bulk") {
+  for (size_t count : {0, 1, 7, 8, 9, 33, 100}) {
+    std::vector<uint16_t> u16(count);
+    std::vector<uint32_t> u32(count);
+    std::vector<uint64_t> u64(count);
+    for (size_t i = 0; i < count; ++i) {
+      u16[i] = static_cast<uint16_t>(i * 0x0101 + 1);
+      u32[i] = static_cast<uint32_t>(i * 0x01010101 + 2);
+      u64[i] = i * 0x0101010101010101ull + 3;
+    }
+    auto buf = Buffer::allocate(count * 14);
+    buf.write_be(std::span<uint16_t>{u16}, 0);
+    buf.write_be(std::span<uint32_t>{u32}, count * 2);
+    buf.write_be(std::span<uint64_t>{u64}, count * 6);
+    for (size_t i = 0; i < count; ++i) {
+      REQUIRE(buf.read_be<uint16_t>(i * 2) == u16[i]);
+      REQUIRE(buf.read_be<uint32_t>(count * 2 + i * 4) == u32[i]);
+      REQUIRE(buf.read_be<uint64_t>(count * 6 + i * 8) == u64[i]);
+    }
+    std::vector<uint16_t> r16(count);
+    std::vector<uint32_t> r32(count);
+    std::vector<uint64_t> r64(count);
+    buf.read_be(std::span<uint16_t>{r16}, 0);
+    buf.read_be(std::span<uint32_t>{r32}, count * 2);
+    buf.read_be(std::span<uint64_t>{r64}, count * 6);
+    REQUIRE(r16 == u16);
+    REQUIRE(r32 == u32);
+    REQUIRE(r64 == u64);
+    buf.write_le(std::span<uint32_t>{u32}, 0);
+    buf.read_le(std::span<uint32_t>{r32}, 0);
+    REQUIRE(r32 == u32);
+  }
+}
+
+TEST_CASE("Buffer.ref_count_policy(ThreadConfined)") {
+  CountingResource resource;
+  {
+    auto buf = Buffer::allocate(16, &resource);
+    REQUIRE(buf.ref_count_policy() == RefCountPolicy::Atomic);
+    buf.ref_count_policy(RefCountPolicy::ThreadConfined);
+    std::vector<Buffer> spans;
+    for (size_t i = 0; i < 16; ++i)
+      spans.push_back(buf.span(i, 1));
+    REQUIRE(spans[3].ref_count_policy() == RefCountPolicy::ThreadConfined);
+    spans[3][0] = 'x';
+    REQUIRE(buf[3] == 'x');
+    REQUIRE(buf.copy().ref_count_policy() == RefCountPolicy::Atomic);
+    buf = Buffer{};
+    REQUIRE(resource.deallocations == 1);
+    spans.clear();
+    REQUIRE(resource.deallocations == 2);
+  }
+}
+
 TEST_CASE("Buffer.span() shallow") {
   std::string str{"hello world!"};
   auto buf = Buffer::copy_of(str);
@@ -301,6 +518,79 @@ TEST_CASE("Buffer.clear()") {
   REQUIRE(buf.str() == "\0\0\0\0\0\0");
 }
 
+TEST_CASE("Buffer(string&&) adopts without copying") {
+  std::string src(100, 'x');
+  auto data = src.data();
+  Buffer buf{std::move(src)};
+  REQUIRE(buf.size() == 100);
+  REQUIRE(buf.data() == data);
+  auto span = buf.span(10, 5);
+  buf = Buffer{};
+  REQUIRE(span.str() == "xxxxx");
+}
+
+TEST_CASE("FlexBuffer(vector&&) and release_vector()") {
+  std::vector<char> src(100, 'x');
+  auto data = src.data();
+  FlexBuffer buf{std::move(src)};
+  REQUIRE(buf.data() == data);
+  buf.shrink_policy(ShrinkPolicy::never());
+  buf.resize(50);
+  auto released = buf.release_vector();
+  REQUIRE(released.data() == data);
+  REQUIRE(released.size() == 50);
+  REQUIRE(buf.size() == 0);
+  buf << "hello";
+  REQUIRE(buf.str() == "hello");
+}
+
+TEST_CASE("FlexBuffer.release_string() copies when shared") {
+  FlexBuffer buf{std::string{"hello world!"}};
+  auto span = buf.span(0, 5);
+  buf << " and goodbye";
+  REQUIRE(buf.release_string() == "hello world! and goodbye");
+  REQUIRE(span.str() == "hello");
+}
+
+TEST_CASE("FlexBuffer.release()") {
+  CountingResource resource;
+  {
+    FlexBuffer buf{4, &resource};
+    buf << "hello world!";
+    auto data = buf.data();
+    auto released = buf.release();
+    REQUIRE(released.get() == data);
+    REQUIRE(std::string(released.get(), 12) == "hello world!");
+    REQUIRE(buf.size() == 0);
+    buf << "hi";
+    auto span = buf.span();
+    auto copied = buf.release();
+    REQUIRE(copied.get() != span.data());
+    REQUIRE(std::string(copied.get(), 2) == "hi");
+  }
+  REQUIRE(resource.deallocations == resource.allocations);
+
+  FlexBuffer small{64};
+  small << "initial";
+  auto data = small.data();
+  auto initial = small.release();
+  REQUIRE(initial.get() == data);
+  REQUIRE(std::string(initial.get(), 7) == "initial");
+}
+
+TEST_CASE("FlexBuffer keeps its payload apart from its header") {
+  CountingResource resource;
+  {
+    FlexBuffer buf{1 << 16, &resource};
+    REQUIRE(resource.live_bytes == internal::buffer_data_header_size + (1 << 16));
+    buf.resize((1 << 16) + 1);
+    REQUIRE(resource.live_bytes == internal::buffer_data_header_size + (1 << 17));
+    buf.resize(1);
+    REQUIRE(resource.live_bytes == internal::buffer_data_header_size + (1 << 16));
+  }
+  REQUIRE(resource.live_bytes == 0);
+}
+
 TEST_CASE("FlexBuffer(const FlexBuffer&) deep") {
   FlexBuffer buf{8};
   buf << "hello world!";
@@ -366,6 +656,31 @@ TEST_CASE("FlexBuffer.clear_all()") {
   REQUIRE(buf.str() == "\0\0\0\0\0\0\0\0");
 }
 
+TEST_CASE("FlexBuffer.resize(grow, Uninitialized)") {
+  FlexBuffer buf{2 << 20};
+  buf.resize(2 << 20);
+  memset(buf.data(), 'x', buf.size());
+  buf.resize(8 << 20, ResizeMode::Uninitialized);
+  REQUIRE(buf.size() == 8 << 20);
+#if defined(__linux__)
+  REQUIRE(resident_pages(buf.data(), buf.size()) == 0);
+#endif
+  buf[0] = 'a';
+  REQUIRE(buf[0] == 'a');
+}
+
+TEST_CASE("FlexBuffer.clear_all() mapped") {
+  FlexBuffer buf;
+  buf.resize(4 << 20, ResizeMode::Uninitialized);
+  memset(buf.data(), 'x', buf.size());
+  buf.clear_all();
+#if defined(__linux__)
+  REQUIRE(resident_pages(buf.data(), buf.size()) == 0);
+#endif
+  REQUIRE(buf.read<char>(0) == 0);
+  REQUIRE(buf.read<char>((4 << 20) - 1) == 0);
+}
+
 TEST_CASE("FlexBuffer.copy_from(index, size)") {
   FlexBuffer buf;
   buf << "hello world!";
@@ -430,6 +745,76 @@ TEST_CASE("FlexBuffer.resize(grow, IgnoreData)") {
   REQUIRE(buf.span(0, 12).str() != "hello world!");
 }
 
+TEST_CASE("FlexBuffer.shrink_policy(never)") {
+  FlexBuffer buf{8};
+  buf.shrink_policy(ShrinkPolicy::never());
+  buf.resize(1024);
+  auto data = buf.data();
+  for (int i = 0; i < 3; ++i) {
+    buf.resize(0);
+    REQUIRE(buf.capacity() == 1024);
+    buf.resize(1024);
+    REQUIRE(buf.data() == data);
+  }
+  buf.resize(5);
+  buf.shrink_to_fit();
+  REQUIRE(buf.capacity() == 8);
+}
+
+TEST_CASE("FlexBuffer.shrink_policy(low_occupancy)") {
+  FlexBuffer buf{8};
+  buf.shrink_policy(ShrinkPolicy::low_occupancy());
+  buf.resize(64);
+  buf.resize(20);
+  REQUIRE(buf.capacity() == 64);
+  buf.resize(10);
+  REQUIRE(buf.capacity() == 16);
+}
+
+TEST_CASE("FlexBuffer.shrink_policy(low_water_cycles)") {
+  FlexBuffer buf{8};
+  buf.shrink_policy(ShrinkPolicy::low_water_cycles(2));
+  buf.resize(64);
+  buf.resize(0);
+  buf.resize(64);
+  buf.resize(0);
+  REQUIRE(buf.capacity() == 64);
+  buf.resize(4);
+  REQUIRE(buf.capacity() == 64);
+  buf.resize(0);
+  REQUIRE(buf.capacity() == 8);
+  auto copy = buf.flex_copy();
+  REQUIRE(copy.shrink_policy() == ShrinkPolicy::low_water_cycles(2));
+}
+
+TEST_CASE("GrowthPolicy.capacity_for()") {
+  REQUIRE(GrowthPolicy::doubling().capacity_for(100, 16) == 128);
+  REQUIRE(GrowthPolicy::doubling().capacity_for(10, 16) == 16);
+  REQUIRE(GrowthPolicy::golden_ratio().capacity_for(100, 16) == 121);
+  REQUIRE(GrowthPolicy::exact().capacity_for(100, 16) == 100);
+  REQUIRE(GrowthPolicy::page_rounded().capacity_for(5000, 4096) == 8192);
+  REQUIRE(GrowthPolicy::page_rounded(GrowthPolicy::huge_page_size).capacity_for(100, 16) == 2 << 20);
+  REQUIRE(GrowthPolicy::capped_step(1024, 1000).capacity_for(3000, 16) == 3024);
+  REQUIRE(GrowthPolicy::exact().rounded(64).capacity_for(100, 16) == 128);
+  REQUIRE(GrowthPolicy::doubling().capacity_for(static_cast<size_t>(-2), 16) == static_cast<size_t>(-2));
+}
+
+TEST_CASE("FlexBuffer.growth_policy()") {
+  FlexBuffer buf{16};
+  REQUIRE(buf.growth_policy() == GrowthPolicy::doubling());
+  buf.growth_policy(GrowthPolicy::exact());
+  buf << "hello world! hello world!";
+  REQUIRE(buf.capacity() == 25);
+  buf.reserve(3);
+  REQUIRE(buf.capacity() == 28);
+  buf.growth_policy(GrowthPolicy::golden_ratio());
+  buf.resize(29);
+  REQUIRE(buf.capacity() == 42);
+  REQUIRE(buf.span(0, 12).str() == "hello world!");
+  auto copy = buf.flex_copy();
+  REQUIRE(copy.growth_policy() == GrowthPolicy::golden_ratio());
+}
+
 TEST_CASE("FlexBuffer.reserve(size)") {
   FlexBuffer buf;
   auto span1 = buf.reserve(2);
@@ -441,6 +826,24 @@ TEST_CASE("FlexBuffer.reserve(size)") {
   REQUIRE(buf.str() == "abcd");
 }
 
+TEST_CASE("FlexBuffer.reserve_capacity(capacity)") {
+  FlexBuffer buf{16};
+  buf << "hello";
+  buf.reserve_capacity(1000);
+  REQUIRE(buf.size() == 5);
+  REQUIRE(buf.capacity() == 1024);
+  REQUIRE(buf.str() == "hello");
+  auto data = buf.data();
+  for (int i = 0; i < 100; ++i)
+    buf << static_cast<uint64_t>(i);
+  REQUIRE(buf.data() == data);
+  buf.reserve_capacity(10);
+  REQUIRE(buf.capacity() == 1024);
+  buf.growth_policy(GrowthPolicy::exact());
+  buf.reserve_capacity(1500);
+  REQUIRE(buf.capacity() == 1500);
+}
+
 TEST_CASE("FlexBuffer.reserve(size) spans do not dangle") {
   FlexBuffer buf;
   auto span1 = buf.reserve(2);
@@ -454,6 +857,66 @@ TEST_CASE("FlexBuffer.reserve(size) spans do not dangle") {
   REQUIRE(span2.str() == "34");
 }
 
+TEST_CASE("FlexBuffer.resize() moves spans with the data") {
+  FlexBuffer buf{4};
+  buf << "abcd";
+  auto span = buf.span(0, 4);
+  buf << "efgh";
+  REQUIRE(buf.capacity() == 8);
+  REQUIRE(span.str() == "abcd");
+  span[0] = 'A';
+  REQUIRE(buf.str() == "Abcdefgh");
+}
+
+TEST_CASE("FlexBuffer(initial_capacity, resource)") {
+  CountingResource resource;
+  {
+    FlexBuffer buf{4, &resource};
+    buf << "hello world!";
+    REQUIRE(buf.capacity() == 16);
+    REQUIRE(resource.allocations == 3);
+    REQUIRE(resource.deallocations == 1);
+    auto copy1 = buf.flex_copy();
+    FlexBuffer copy2{buf};
+    REQUIRE(copy1.resource() == &resource);
+    REQUIRE(copy2.resource() == &resource);
+    REQUIRE(copy2.str() == "hello world!");
+    REQUIRE(resource.allocations == 7);
+  }
+  REQUIRE(resource.deallocations == resource.allocations);
+}
+
+TEST_CASE("FlexBuffer with monotonic_buffer_resource") {
+  std::pmr::monotonic_buffer_resource arena;
+  FlexBuffer buf{8, &arena};
+  buf << "hello world!";
+  buf << " and goodbye";
+  REQUIRE(buf.str() == "hello world! and goodbye");
+}
+
+TEST_CASE("FlexBuffer.resize() in place across heap kinds") {
+  FlexBuffer buf{16};
+  buf << "hello world!";
+  auto span = buf.span(0, 5);
+  // inline -> malloc -> malloc (realloc) -> mapped -> mapped (mremap) -> malloc
+  for (size_t size : {100, 1000, 2 << 20, 8 << 20, 12}) {
+    buf.resize(size);
+    buf[size - 1] = '!';
+    REQUIRE(buf.span(0, 12).str() == "hello world!");
+    REQUIRE(span.str() == "hello");
+  }
+  REQUIRE(buf.capacity() == 16);
+}
+
+TEST_CASE("FlexBuffer.resize(grow, IgnoreData) in place") {
+  FlexBuffer buf{4 << 20};
+  buf.resize(100);
+  buf.resize(16 << 20, ResizeMode::IgnoreData);
+  REQUIRE(buf.size() == 16 << 20);
+  buf[(16 << 20) - 1] = 'x';
+  REQUIRE(buf.read<char>((16 << 20) - 1) == 'x');
+}
+
 TEST_CASE("FlexBuffer << string") {
   FlexBuffer buf;
   buf << "hello";
@@ -490,6 +953,747 @@ TEST_CASE("FlexBuffer << uint32_t") {
   REQUIRE(read == 123456789);
 }
 
+TEST_CASE("CowBuffer copies share until written") {
+  CowBuffer a{Buffer::copy_of(std::string{"hello world!"})};
+  CowBuffer b{a};
+  CowBuffer c;
+  c = a;
+  REQUIRE(std::as_const(a).data() == std::as_const(b).data());
+  REQUIRE(std::as_const(c).data() == std::as_const(a).data());
+  REQUIRE(b.shared());
+  b[0] = 'j';
+  b.write<uint8_t>('W', 6);
+  REQUIRE(b.str() == "jello World!");
+  REQUIRE(a.str() == "hello world!");
+  REQUIRE(c.str() == "hello world!");
+  REQUIRE(!b.shared());
+  auto data = b.data();
+  b.write_be<uint16_t>(0x6869);
+  REQUIRE(b.data() == data);
+  REQUIRE(b.str() == "hillo World!");
+
+  auto span = a.span(0, 8);
+  span.write<uint32_t>(2, 0);
+  REQUIRE(span.read<uint32_t>(0) == 2);
+  REQUIRE(a.str() == "hello world!");
+  REQUIRE(c.str() == "hello world!");
+}
+
+TEST_CASE("CowFlexBuffer detaches on resize and append") {
+  CowFlexBuffer a{FlexBuffer{}};
+  a << "hello";
+  auto b = a;
+  auto span = a.span(0, 5);
+  b << " world!";
+  REQUIRE(b.str() == "hello world!");
+  REQUIRE(a.str() == "hello");
+  a.resize(2);
+  REQUIRE(a.str() == "he");
+  REQUIRE(span.str() == "hello");
+  REQUIRE(b.release_string() == "hello world!");
+  REQUIRE(b.size() == 0);
+
+  CountingResource resource;
+  CowFlexBuffer shared{FlexBuffer{64, &resource}};
+  shared << "hello";
+  shared.reserve_capacity(4096);
+  auto copy = shared;
+  auto allocations = resource.allocations;
+  copy.resize(10, ResizeMode::IgnoreData);
+  REQUIRE(copy.size() == 10);
+  REQUIRE(copy.capacity() == 64);
+  REQUIRE(shared.str() == "hello");
+  REQUIRE(resource.allocations == allocations + 2);
+  REQUIRE(copy.resource() == &resource);
+}
+
+namespace {
+template <typename T>
+bool holds_inline(const T& buf) {
+  auto object = reinterpret_cast<const char*>(&buf);
+  return buf.data() >= object && buf.data() + buf.capacity() <= object + sizeof(T);
+}
+} // namespace
+
+TEST_CASE("SmallFlexBuffer stays inline") {
+  SmallFlexBuffer<32> buf;
+  buf << "hello" << uint8_t{' '} << "world!";
+  REQUIRE(!buf.spilled());
+  REQUIRE(holds_inline(buf));
+  REQUIRE(buf.size() == 12);
+  REQUIRE(buf.capacity() == 32);
+  REQUIRE(buf.str() == "hello world!");
+  REQUIRE(reinterpret_cast<uintptr_t>(buf.data()) % __STDCPP_DEFAULT_NEW_ALIGNMENT__ == 0);
+  buf.write<uint32_t>(0x6c6c656a, 0);
+  REQUIRE(buf.read<char>(0) == 'j');
+  REQUIRE_THROWS(buf.read<uint64_t>(8));
+  REQUIRE_THROWS_AS(buf.read<uint8_t>(SIZE_MAX), std::range_error);
+  REQUIRE_THROWS_AS(buf.copy(13), std::range_error);
+  REQUIRE_THROWS_AS(buf.copy(13, 0), std::range_error);
+  REQUIRE(buf.copy(12).size() == 0);
+  auto copy = buf;
+  copy[0] = 'h';
+  REQUIRE(buf.str() == "jello world!");
+  REQUIRE(copy.str() == "hello world!");
+  REQUIRE(holds_inline(copy));
+}
+
+TEST_CASE("SmallFlexBuffer spills") {
+  SmallFlexBuffer<16> buf;
+  buf << "hello world!";
+  auto span = buf.span(0, 5);
+  REQUIRE(buf.spilled());
+  REQUIRE(!holds_inline(buf));
+  buf << " and goodbye";
+  REQUIRE(buf.str() == "hello world! and goodbye");
+  REQUIRE(buf.capacity() == 32);
+  REQUIRE(span.str() == "hello");
+
+  SmallFlexBuffer<16> grown;
+  grown << "hello world!";
+  grown << " and goodbye";
+  REQUIRE(grown.spilled());
+  auto moved = std::move(grown);
+  REQUIRE(moved.str() == "hello world! and goodbye");
+  REQUIRE(!grown.spilled());
+  REQUIRE(grown.size() == 0);
+}
+
+TEST_CASE("FixedBuffer compile-time offsets") {
+  FixedBuffer<16> buf;
+  static_assert(FixedBuffer<16>::size() == 16);
+  static_assert(sizeof(FixedBuffer<64>) == 64);
+  // wrapping allocates a header, which may throw
+  static_assert(!std::is_nothrow_convertible_v<FixedBuffer<16>&, Buffer>);
+  static_assert(!std::is_nothrow_convertible_v<const FixedBuffer<16>&, const Buffer>);
+  REQUIRE(buf.read<uint64_t, 8>() == 0);
+  buf.write<uint32_t, 0>(0x01020304);
+  buf.write_be<uint32_t, 4>(0x01020304);
+  buf.write_le<uint16_t, 14>(0x0506);
+  REQUIRE(buf.read<uint32_t, 0>() == 0x01020304);
+  REQUIRE(buf.read_be<uint32_t, 4>() == 0x01020304);
+  REQUIRE(buf[4] == 0x01);
+  REQUIRE(buf.read_le<uint16_t, 14>() == 0x0506);
+  REQUIRE(buf.read<uint16_t>(14) == buf.read<uint16_t, 14>());
+  REQUIRE_THROWS(buf.read<uint16_t>(15));
+  REQUIRE_THROWS(buf.write<uint8_t>(1, 16));
+  auto copy = buf;
+  copy.clear();
+  REQUIRE(copy.read<uint32_t, 0>() == 0);
+  REQUIRE(buf.read<uint32_t, 0>() == 0x01020304);
+}
+
+TEST_CASE("FixedBuffer with BufferReader and BufferWriter") {
+  FixedBuffer<12> buf;
+  BufferWriter writer{buf};
+  writer << "hello" << uint8_t{' '};
+  writer.write_be<uint32_t>(42);
+  REQUIRE_THROWS(writer << uint32_t{0});
+  BufferReader reader{buf};
+  REQUIRE(reader.next(6).str() == "hello ");
+  REQUIRE(reader.next_be<uint32_t>() == 42);
+  std::span<const char, 12> view = buf;
+  REQUIRE(view.data() == buf.data());
+  REQUIRE(buf.span(0, 5).str() == "hello");
+  REQUIRE(buf.copy(0, 5).str() == "hello");
+  REQUIRE_THROWS(buf.span(8, 5));
+}
+
+TEST_CASE("ChainBuffer appends segments") {
+  ChainBuffer chain{8};
+  REQUIRE(chain.segment_count() == 0);
+  chain << "hello " << uint32_t{0x01020304} << "world!";
+  REQUIRE(chain.size() == 16);
+  REQUIRE(chain.segment_count() == 2);
+  auto first = chain.segment(0);
+  chain << "goodbye";
+  REQUIRE(chain.segment_count() == 3);
+  REQUIRE(chain.segment(2).str() == "goodbye");
+  REQUIRE(first.data() == chain.segment(0).data());
+  REQUIRE_THROWS(chain.segment(3));
+  auto linear = chain.linearize();
+  REQUIRE(linear.size() == 23);
+  REQUIRE(linear.read<uint32_t>(6) == 0x01020304);
+  REQUIRE(linear.span(10).str() == "world!goodbye");
+  REQUIRE(chain.str() == linear.str());
+  auto copy = chain;
+  chain.reset();
+  REQUIRE(chain.size() == 0);
+  REQUIRE(copy.str() == linear.str());
+  REQUIRE_THROWS(ChainBuffer{0});
+
+  auto moved = std::move(copy);
+  REQUIRE(moved.str() == linear.str());
+  REQUIRE(copy.size() == 0);
+  REQUIRE(copy.str().empty());
+  copy << "again";
+  REQUIRE(copy.str() == "again");
+  chain = std::move(copy);
+  REQUIRE(chain.str() == "again");
+  REQUIRE(copy.segment_count() == 0);
+  copy << "and again";
+  REQUIRE(copy.str() == "and again");
+}
+
+TEST_CASE("ChainReader across segment boundaries") {
+  ChainBuffer chain{8};
+  chain << "hello " << uint32_t{0x01020304};
+  Buffer be = Buffer::allocate(2);
+  be.write_be<uint16_t>(42);
+  chain << be << "world!";
+  ChainReader reader{chain};
+  REQUIRE(reader.remaining() == 18);
+  auto hello = reader.next(5);
+  REQUIRE(hello.str() == "hello");
+  REQUIRE(hello.data() == chain.segment(0).data());
+  REQUIRE(reader.next<char>() == ' ');
+  REQUIRE(reader.peek<uint32_t>() == 0x01020304);
+  REQUIRE(reader.next<uint32_t>() == 0x01020304);
+  REQUIRE(reader.next_be<uint16_t>() == 42);
+  REQUIRE(reader.next(6).str() == "world!");
+  REQUIRE(reader.remaining() == 0);
+  REQUIRE_THROWS(reader.next<char>());
+  reader.position(3);
+  REQUIRE(reader.next(6).str() == "lo \x04\x03\x02");
+
+  ChainBuffer full{8};
+  full << uint64_t{1} << uint64_t{2};
+  ChainReader at_end{full};
+  at_end.position(16);
+  REQUIRE(at_end.peek(0).size() == 0);
+  REQUIRE(at_end.next(0).size() == 0);
+  REQUIRE_THROWS(at_end.next(1));
+  ChainReader empty{ChainBuffer{}};
+  REQUIRE(empty.next(0).size() == 0);
+}
+
+#if defined(__linux__)
+TEST_CASE("ChainBuffer.iovecs() with writev") {
+  ChainBuffer chain{4};
+  chain << "hello world!!";
+  auto iov = chain.iovecs();
+  REQUIRE(iov.size() == 4);
+  REQUIRE(iov[3].iov_len == 1);
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  REQUIRE(writev(fds[1], iov.data(), static_cast<int>(iov.size())) == 13);
+  char out[13];
+  REQUIRE(read(fds[0], out, sizeof(out)) == 13);
+  REQUIRE(std::string{out, sizeof(out)} == "hello world!!");
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("IoVecList.advance()") {
+  auto header = Buffer::copy_of(std::string_view{"head"});
+  FlexBuffer body;
+  body << "body!";
+  IoVecList list{header, Buffer{}, body};
+  REQUIRE(list.count() == 2);
+  REQUIRE(list.size() == 9);
+  list.advance(2);
+  REQUIRE(list.count() == 2);
+  REQUIRE(std::string{static_cast<char*>(list.data()[0].iov_base), list.data()[0].iov_len} == "ad");
+  list.advance(3);
+  REQUIRE(list.count() == 1);
+  REQUIRE(std::string{static_cast<char*>(list.data()[0].iov_base), list.data()[0].iov_len} == "ody!");
+  REQUIRE_THROWS(list.advance(5));
+  list.advance(4);
+  REQUIRE(list.empty());
+  REQUIRE(list.count() == 0);
+}
+
+TEST_CASE("write_to_fd() and read_into() with a socketpair") {
+  int fds[2];
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  auto header = Buffer::allocate(4);
+  header.write_be<uint32_t>(11);
+  ChainBuffer chain{4};
+  chain << "hello world";
+  REQUIRE(write_to_fd(fds[0], header, chain) == 15);
+
+  FlexBuffer in;
+  REQUIRE(read_into(fds[1], in, 4) == 4);
+  REQUIRE(in.read_be<uint32_t>(0) == 11);
+  auto body = Buffer::allocate(11);
+  IoVecList list{body.span(0, 5), body.span(5)};
+  REQUIRE(read_into(fds[1], list) == 11);
+  REQUIRE(body.str() == "hello world");
+
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  REQUIRE(read_into(fds[1], in, 4) == -1);
+  close(fds[0]);
+  REQUIRE(read_into(fds[1], in, 4096) == 0);
+  REQUIRE(in.size() == 4);
+  REQUIRE(in.capacity() >= 4100);
+  close(fds[1]);
+
+  REQUIRE(pipe(fds) == 0);
+  REQUIRE(write(fds[1], "hello", 5) == 5);
+  FlexBuffer grown{4};
+  grown << "abcd";
+  REQUIRE(read_into(fds[0], grown) == 4);
+  REQUIRE(grown.str() == "abcdhell");
+  REQUIRE(read_into(fds[0], grown) == 1);
+  REQUIRE(grown.str() == "abcdhello");
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_CASE("write_to_fd() resumes after a partial non-blocking write") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  auto big = Buffer::allocate(1 << 20);
+  for (size_t i = 0; i < big.size(); ++i)
+    big[i] = static_cast<char>(i);
+  IoVecList list{big.span(0, 1000), big.span(1000)};
+  auto written = write_to_fd(fds[1], list);
+  REQUIRE(written < big.size());
+  REQUIRE(list.size() == big.size() - written);
+
+  auto out = Buffer::allocate(big.size());
+  IoVecList reads{out};
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  while (!list.empty()) {
+    read_into(fds[0], reads);
+    write_to_fd(fds[1], list);
+  }
+  read_into(fds[0], reads);
+  REQUIRE(reads.empty());
+  REQUIRE(std::memcmp(out.data(), big.data(), big.size()) == 0);
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
+#if defined(__linux__)
+namespace {
+std::string temp_file(const std::string& contents) {
+  char path[] = "/tmp/flexbuf_test_XXXXXX";
+  int fd = mkstemp(path);
+  REQUIRE(fd >= 0);
+  REQUIRE(write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()));
+  close(fd);
+  return path;
+}
+
+std::string read_file(const std::string& path) {
+  const auto file = Buffer::map_file(path);
+  return file.str();
+}
+} // namespace
+
+TEST_CASE("Buffer::map_file() read-only") {
+  auto path = temp_file("hello world!");
+  ReadOnlyBuffer span;
+  {
+    auto file = Buffer::map_file(path, {.populate = true, .advice = MapAdvice::Sequential});
+    static_assert(std::is_same_v<decltype(file.data()), const char*>);
+    static_assert(std::is_same_v<decltype(file[0]), const char&>);
+    static_assert(std::is_same_v<decltype(file.span()), ReadOnlyBuffer>);
+    static_assert(!std::is_convertible_v<ReadOnlyBuffer&, Buffer&>);
+    static_assert(!std::is_convertible_v<ReadOnlyBuffer&, const Buffer&>);
+    REQUIRE(file.size() == 12);
+    REQUIRE(file.str() == "hello world!");
+    REQUIRE(file[4] == 'o');
+    REQUIRE(file.read_be<uint16_t>(0) == 0x6865);
+    file.advise(MapAdvice::WillNeed, 6);
+    REQUIRE_THROWS(file.advise(MapAdvice::Random, 6, 7));
+    span = file.span(6, 5);
+    auto shared = file;
+    REQUIRE(shared.data() == file.data());
+    auto copy = file.copy(0, 5);
+    copy[0] = 'j';
+    REQUIRE(copy.str() == "jello");
+    REQUIRE(file.str() == "hello world!");
+  }
+  REQUIRE(span.str() == "world");
+  REQUIRE_THROWS_AS(span.span(6), std::range_error);
+  auto empty = temp_file("");
+  REQUIRE(Buffer::map_file(empty).size() == 0);
+  unlink(empty.c_str());
+  REQUIRE_THROWS_AS(Buffer::map_file("/nonexistent/flexbuf"), std::system_error);
+  unlink(path.c_str());
+}
+
+TEST_CASE("Buffer::map_file() read-write") {
+  auto path = temp_file("hello world!");
+  auto shared = Buffer::map_file(path, MapMode::Shared);
+  shared[0] = 'j';
+  REQUIRE(read_file(path) == "jello world!");
+  auto priv = Buffer::map_file(path, MapMode::Private, {.advise_huge_pages = true});
+  priv[0] = 'y';
+  REQUIRE(priv.str() == "yello world!");
+  REQUIRE(read_file(path) == "jello world!");
+  unlink(path.c_str());
+}
+#endif
+
+#if defined(__linux__)
+TEST_CASE("FlexBuffer::file_backed()") {
+  char path[] = "/tmp/flexbuf_test_XXXXXX";
+  close(mkstemp(path));
+  auto buf = FlexBuffer::file_backed(path, 16);
+  buf << "hello world!";
+  auto span = buf.span(0, 5);
+  auto chunk = Buffer::allocate(1 << 16);
+  chunk.clear();
+  for (int i = 0; i < 64; ++i)
+    buf << chunk;
+  REQUIRE(buf.capacity() >= buf.size());
+  struct stat st;
+  REQUIRE(stat(path, &st) == 0);
+  REQUIRE(static_cast<size_t>(st.st_size) == buf.capacity());
+  REQUIRE(span.str() == "hello");
+  buf.resize(12);
+  buf.sync();
+  REQUIRE(buf.capacity() == 12);
+  REQUIRE(Buffer::map_file(path).str() == "hello world!");
+  buf << " and goodbye";
+  REQUIRE(buf.str() == "hello world! and goodbye");
+  REQUIRE_THROWS_AS(FlexBuffer::file_backed("/nonexistent/flexbuf"), std::system_error);
+  unlink(path);
+}
+
+TEST_CASE("FlexBuffer::memfd_backed()") {
+  auto buf = FlexBuffer::memfd_backed();
+  buf << uint32_t{42} << "hello";
+  buf.reserve_capacity(1 << 20);
+  REQUIRE(buf.read<uint32_t>(0) == 42);
+  auto copy = buf;
+  buf.resize(0);
+  REQUIRE(copy.span(4).str() == "hello");
+  buf.shrink_to_fit();
+  REQUIRE(buf.size() == 0);
+}
+
+TEST_CASE("FlexBuffer::file_backed() throws when the file cannot grow") {
+  char path[] = "/tmp/flexbuf_test_XXXXXX";
+  close(mkstemp(path));
+  auto buf = FlexBuffer::file_backed(path, 4096);
+  buf << "hello";
+  // a file size limit makes ftruncate fail like a full disk would
+  auto previous_handler = signal(SIGXFSZ, SIG_IGN);
+  rlimit previous_limit;
+  REQUIRE(getrlimit(RLIMIT_FSIZE, &previous_limit) == 0);
+  rlimit limit{1 << 16, previous_limit.rlim_max};
+  REQUIRE(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+  REQUIRE_THROWS_AS(buf.reserve_capacity(1 << 20), std::system_error);
+  REQUIRE_THROWS_AS(buf << Buffer::allocate(1 << 20), std::system_error);
+  setrlimit(RLIMIT_FSIZE, &previous_limit);
+  signal(SIGXFSZ, previous_handler);
+  REQUIRE(buf.size() == 5);
+  REQUIRE(buf.capacity() == 4096);
+  REQUIRE(buf.str() == "hello");
+  buf << " world";
+  REQUIRE(buf.str() == "hello world");
+  unlink(path);
+}
+#endif
+
+TEST_CASE("BufferPool size classes") {
+  REQUIRE(BufferPool::size_class(1) == 16);
+  REQUIRE(BufferPool::size_class(16) == 16);
+  REQUIRE(BufferPool::size_class(17) == 32);
+  REQUIRE(BufferPool::size_class(4096) == 4096);
+  REQUIRE(BufferPool::size_class(4097) == 8192);
+}
+
+TEST_CASE("BufferPool recycles on last reference") {
+  BufferPool pool;
+  Buffer span;
+  {
+    auto buf = pool.buffer(4096);
+    REQUIRE(buf.resource() == &pool);
+    REQUIRE(pool.misses() == 1);
+    span = buf.span(0, 4);
+  }
+  REQUIRE(pool.hits() == 0);
+  auto other = pool.buffer(4096);
+  REQUIRE(pool.misses() == 2);
+  span = Buffer{};
+  auto recycled = pool.buffer(5000);
+  REQUIRE(pool.hits() == 1);
+  REQUIRE(pool.misses() == 2);
+}
+
+TEST_CASE("BufferPool FlexBuffer growth") {
+  BufferPool pool;
+  {
+    auto buf = pool.flex_buffer(100);
+    REQUIRE(buf.initial_capacity() == 128);
+    REQUIRE(buf.capacity() == 128);
+    buf.resize(1000);
+    REQUIRE(buf.capacity() >= 1000);
+    REQUIRE(buf.resource() == &pool);
+  }
+  // the header and the initial payload, then the grown payload
+  auto misses = pool.misses();
+  REQUIRE(misses == 3);
+  auto buf = pool.flex_buffer(128);
+  buf.resize(1000);
+  REQUIRE(pool.misses() == misses);
+  REQUIRE(pool.hits() == 3);
+}
+
+TEST_CASE("BufferPool across threads") {
+  BufferPool pool;
+  std::atomic<size_t> mismatches{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&pool, &mismatches]() {
+      for (int i = 0; i < 1000; ++i) {
+        auto buf = pool.flex_buffer(64);
+        buf << static_cast<uint64_t>(i);
+        if (buf.read<uint64_t>(0) != static_cast<uint64_t>(i))
+          ++mismatches;
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  REQUIRE(mismatches == 0);
+  REQUIRE(pool.hits() + pool.misses() == 8000);
+  REQUIRE(pool.misses() <= 8);
+}
+
+TEST_CASE("BufferPool reclaims blocks cached by other threads") {
+  CountingResource upstream;
+  std::atomic<int> stage{0};
+  std::thread thread;
+  {
+    BufferPool pool{BufferPool::default_max_pooled_size, &upstream};
+    thread = std::thread{[&pool, &stage]() {
+      pool.buffer(100);
+      stage = 1;
+      while (stage != 2)
+        std::this_thread::yield();
+    }};
+    while (stage != 1)
+      std::this_thread::yield();
+    REQUIRE(upstream.allocations == 1);
+    REQUIRE(upstream.deallocations == 0);
+  }
+  REQUIRE(upstream.deallocations == 1);
+  stage = 2;
+  thread.join();
+  REQUIRE(upstream.deallocations == 1);
+}
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+namespace {
+std::unique_ptr<IoUring> make_ring() {
+  try {
+    return std::make_unique<IoUring>(8);
+  } catch (const std::system_error& e) {
+    WARN("io_uring unavailable: " << e.what());
+    return nullptr;
+  }
+}
+} // namespace
+
+TEST_CASE("IoUring reads and writes a pipe and a socketpair in one submission") {
+  auto ring = make_ring();
+  if (!ring)
+    return;
+  int pipe_fds[2];
+  int socket_fds[2];
+  REQUIRE(pipe(pipe_fds) == 0);
+  REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, socket_fds) == 0);
+  ring->write(pipe_fds[1], Buffer::copy_of(std::string_view{"hello"}), 1);
+  ring->write(socket_fds[0], Buffer::copy_of(std::string_view{"world!"}), 2);
+  FlexBuffer in;
+  in.reserve_capacity(32);
+  ring->read(pipe_fds[0], in.reserve(16), 3);
+  ring->read(socket_fds[1], in.reserve(16), 4);
+  REQUIRE_THROWS_AS(in.reserve_capacity(1 << 20), std::logic_error);
+  REQUIRE(in.capacity() == 32);
+  REQUIRE(ring->pending() == 4);
+  REQUIRE(ring->submit() == 4);
+  REQUIRE(ring->pending() == 0);
+  std::vector<IoCompletion> completions;
+  while (completions.size() < 4)
+    ring->complete(completions, 1);
+  REQUIRE(ring->in_flight() == 0);
+  std::map<uint64_t, IoCompletion> by_id;
+  for (auto& completion : completions)
+    by_id.emplace(completion.user_data, completion);
+  REQUIRE(by_id.at(1).result == 5);
+  REQUIRE(by_id.at(2).result == 6);
+  REQUIRE(by_id.at(3).buffer.str() == "hello");
+  REQUIRE(by_id.at(4).buffer.str() == "world!");
+  REQUIRE(in.span(0, 5).str() == "hello");
+  in.reserve_capacity(1 << 20);
+  REQUIRE(in.span(0, 5).str() == "hello");
+  for (int fd : {pipe_fds[0], pipe_fds[1], socket_fds[0], socket_fds[1]})
+    close(fd);
+}
+
+TEST_CASE("IoUring fixed buffers with a file") {
+  BufferPool pool;
+  auto ring = make_ring();
+  if (!ring)
+    return;
+  ring->register_buffers(2, 64, &pool);
+  REQUIRE_THROWS(ring->register_buffers(1, 64));
+  auto a = ring->fixed_buffer();
+  auto b = ring->fixed_buffer();
+  REQUIRE(a);
+  REQUIRE(b);
+  REQUIRE(!ring->fixed_buffer());
+  char path[] = "/tmp/flexbuf_test_XXXXXX";
+  int fd = mkstemp(path);
+  unlink(path);
+  a->write<uint64_t>(42, 8);
+  ring->write(fd, a->span(0, 16), 1, 0);
+  a.reset();
+  std::vector<IoCompletion> completions;
+  REQUIRE(ring->complete(completions, 1) == 1);
+  REQUIRE(completions[0].result == 16);
+  completions.clear();
+  ring->read(fd, b->span(0, 32), 2, 0);
+  b.reset();
+  REQUIRE(ring->complete(completions, 1) == 1);
+  REQUIRE(completions[0].result == 16);
+  REQUIRE(completions[0].buffer.read<uint64_t>(8) == 42);
+  a = ring->fixed_buffer();
+  REQUIRE(a);
+  REQUIRE(!ring->fixed_buffer());
+  completions.clear();
+  REQUIRE(ring->fixed_buffer());
+  close(fd);
+}
+
+TEST_CASE("IoUring rejects operations larger than 4 GiB") {
+  auto ring = make_ring();
+  if (!ring)
+    return;
+  char byte = 0;
+  auto huge = Buffer::wrap(&byte, 0, static_cast<size_t>(UINT32_MAX) + 1);
+  REQUIRE_THROWS_AS(ring->write(1, huge), std::length_error);
+  REQUIRE(ring->pending() == 0);
+}
+
+TEST_CASE("IoUring cancels reads in flight on destruction") {
+  auto ring = make_ring();
+  if (!ring)
+    return;
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  ring->read(fds[0], Buffer::allocate(16));
+  ring->submit();
+  REQUIRE(ring->in_flight() == 1);
+  ring.reset();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_CASE("IoUring cancels more reads than the completion queue has room for") {
+  auto ring = make_ring();
+  if (!ring)
+    return;
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  // a ring of 8 entries has 16 completion entries, one of which is kept free for cancelling
+  for (int i = 0; i < 15; ++i)
+    ring->read(fds[0], Buffer::allocate(1), i);
+  REQUIRE_THROWS_AS(ring->read(fds[0], Buffer::allocate(1)), std::runtime_error);
+  ring->submit();
+  REQUIRE(ring->in_flight() == 15);
+  ring.reset();
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
+
+namespace {
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() noexcept {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+Detached parse_frames(AsyncBufferReader& reader, std::vector<Buffer>& frames, bool& ended) {
+  try {
+    while (true) {
+      auto length = co_await reader.next_be<uint32_t>();
+      frames.push_back(co_await reader.next(length));
+    }
+  } catch (const std::runtime_error&) {
+    ended = true;
+  }
+}
+} // namespace
+
+TEST_CASE("AsyncBufferReader reassembles frames across appends") {
+  AsyncBufferReader reader;
+  std::vector<Buffer> frames;
+  bool ended = false;
+  parse_frames(reader, frames, ended);
+  auto frame = [](std::string_view body) {
+    auto result = Buffer::allocate(4 + body.size());
+    result.write_be<uint32_t>(static_cast<uint32_t>(body.size()));
+    result.write(Buffer::wrap(body), 4);
+    return result;
+  };
+  auto first = frame("hello");
+  reader << first.span(0, 2);
+  REQUIRE(frames.empty());
+  reader << first.span(2, 5);
+  REQUIRE(frames.empty());
+  reader << first.span(7) << frame("world!");
+  REQUIRE(frames.size() == 2);
+  REQUIRE(frames[0].str() == "hello");
+  REQUIRE(frames[1].str() == "world!");
+  REQUIRE(reader.available() == 0);
+
+  auto& buffer = reader.buffer();
+  REQUIRE(buffer.size() == 0);
+  buffer << frame("goodbye") << frame("");
+  reader.notify();
+  REQUIRE(frames.size() == 4);
+  REQUIRE(frames[0].str() == "hello");
+  REQUIRE(frames[2].str() == "goodbye");
+  REQUIRE(frames[3].size() == 0);
+  REQUIRE(!ended);
+  reader << std::string_view{"\0\0"};
+  reader.close();
+  REQUIRE(ended);
+  REQUIRE(reader.closed());
+}
+
+TEST_CASE("AsyncBufferReader.next() spans are zero-copy") {
+  AsyncBufferReader reader;
+  reader << std::string_view{"hello world!"};
+  std::vector<Buffer> frames;
+  [](AsyncBufferReader& reader, std::vector<Buffer>& frames) -> Detached {
+    frames.push_back(co_await reader.next(5));
+    frames.push_back(Buffer::allocate(co_await reader.next<uint8_t>()));
+    frames.push_back(co_await reader.next(6));
+  }(reader, frames);
+  REQUIRE(frames.size() == 3);
+  REQUIRE(frames[0].data() + 6 == frames[2].data());
+  REQUIRE(frames[2].str() == "world!");
+  frames.clear();
+  reader << std::string_view{"abc"};
+  REQUIRE(reader.buffer().str() == "abc");
+}
+
 TEST_CASE("BufferWriter and BufferReader") {
   auto buf = Buffer::allocate(12);
   BufferWriter writer{buf};
@@ -527,6 +1731,276 @@ TEST_CASE("BufferWriter and BufferReader fundamental types") {
   REQUIRE(reader.next<uint32_t>() == 5678);
 }
 
+TEST_CASE("BufferReader.ensure() and unchecked reads") {
+  auto buf = Buffer::allocate(12);
+  BufferWriter writer{buf};
+  writer << static_cast<uint32_t>(1);
+  writer << static_cast<uint32_t>(2);
+  writer << static_cast<uint32_t>(3);
+  BufferReader reader{buf};
+  reader.ensure(8);
+  REQUIRE(reader.next_unchecked<uint32_t>() == 1);
+  REQUIRE(reader.peek_unchecked<uint32_t>() == 2);
+  REQUIRE(reader.next_unchecked<uint32_t>() == 2);
+  REQUIRE_THROWS(reader.ensure(8), "array index out of bounds");
+  REQUIRE_THROWS(reader.ensure(SIZE_MAX), "array index out of bounds");
+  REQUIRE_THROWS(reader.ensure(SIZE_MAX - 7), "array index out of bounds");
+  REQUIRE_THROWS(buf.check(SIZE_MAX, 2), "array index out of bounds");
+  REQUIRE(reader.position() == 8);
+}
+
+TEST_CASE("Spans past the capacity of a shrunk FlexBuffer throw") {
+  FlexBuffer buf;
+  buf.resize(1 << 20);
+  auto tail = buf.span((1 << 20) - 64, 64);
+  tail.read<uint64_t>(56);
+  buf.resize(16);
+  REQUIRE(buf.capacity() < (1 << 20) - 64);
+  REQUIRE_THROWS_AS(tail.read<uint8_t>(0), std::range_error);
+  REQUIRE_THROWS_AS(tail.check(0, 0), std::range_error);
+  REQUIRE_THROWS_AS(tail.write<uint64_t>(1), std::range_error);
+}
+
+TEST_CASE("BufferWriter and BufferReader endian") {
+  auto buf = Buffer::allocate(6);
+  BufferWriter writer{buf};
+  writer.write_be<uint32_t>(0x01020304);
+  writer.write_le<int16_t>(-2);
+  REQUIRE(buf[0] == 0x01);
+  REQUIRE(buf[3] == 0x04);
+  REQUIRE(buf[4] == static_cast<char>(0xfe));
+  BufferReader reader{buf};
+  REQUIRE(reader.peek_be<uint32_t>() == 0x01020304);
+  REQUIRE(reader.next_be<uint32_t>() == 0x01020304);
+  REQUIRE(reader.peek_le<int16_t>() == -2);
+  REQUIRE(reader.next_le<int16_t>() == -2);
+}
+
+TEST_CASE("FlexBufferWriter grows and backpatches") {
+  FlexBuffer buf{4};
+  buf << "ab";
+  FlexBufferWriter writer{buf};
+  REQUIRE(writer.position() == 2);
+  auto prefix = writer.next(4);
+  writer << "hello world!" << uint8_t{0};
+  writer.write_be<uint16_t>(0x0102);
+  REQUIRE(buf.size() == 21);
+  REQUIRE(buf.capacity() >= 21);
+  writer.patch_be<uint32_t>(2, static_cast<uint32_t>(writer.position() - 6));
+  REQUIRE(buf.read_be<uint32_t>(2) == 15);
+  prefix.write_le<uint32_t>(7);
+  REQUIRE(buf.read_le<uint32_t>(2) == 7);
+  REQUIRE(buf.span(6, 12).str() == "hello world!");
+  REQUIRE_THROWS(writer.patch<uint32_t>(18, 0));
+  REQUIRE_THROWS(writer.position(22));
+
+  writer.position(6);
+  writer << "jello";
+  REQUIRE(buf.size() == 21);
+  REQUIRE(buf.span(6, 12).str() == "jello world!");
+  writer.seek_end();
+  writer.reserve(1000);
+  auto capacity = buf.capacity();
+  for (int i = 0; i < 250; ++i)
+    writer << uint32_t{1};
+  REQUIRE(buf.capacity() == capacity);
+  REQUIRE(buf.size() == 1021);
+
+  writer.position(10);
+  writer.truncate(500);
+  REQUIRE(buf.size() == 500);
+  REQUIRE(writer.position() == 10);
+  writer.truncate(6);
+  REQUIRE(buf.size() == 6);
+  REQUIRE(buf.capacity() == capacity);
+  REQUIRE(writer.position() == 6);
+  writer.truncate(100);
+  REQUIRE(buf.size() == 6);
+}
+
+TEST_CASE("FrameBuilder nests length prefixes") {
+  FlexBuffer buf{8};
+  FrameBuilder builder{buf};
+  builder.begin();
+  builder << "head";
+  {
+    auto inner = builder.frame(LengthPrefix::Uint16LE);
+    builder << "abc";
+    REQUIRE(builder.depth() == 2);
+  }
+  builder.begin(LengthPrefix::Varint);
+  builder << "xy";
+  builder.end();
+  builder.end();
+  REQUIRE(builder.depth() == 0);
+  REQUIRE(buf.size() == 4 + 4 + 2 + 3 + 5 + 2);
+  REQUIRE(buf.read_be<uint32_t>(0) == 16);
+  REQUIRE(buf.span(4, 4).str() == "head");
+  REQUIRE(buf.read_le<uint16_t>(8) == 3);
+  REQUIRE(buf.span(10, 3).str() == "abc");
+  REQUIRE(std::string(buf.data() + 13, 5) == std::string("\x82\x80\x80\x80\x00", 5));
+  REQUIRE(buf.span(18, 2).str() == "xy");
+  REQUIRE_THROWS_AS(builder.end(), std::logic_error);
+
+  buf.resize(0);
+  FrameBuilder varint{buf, LengthPrefix::Varint, 2};
+  varint.begin();
+  for (int i = 0; i < 300; ++i)
+    varint << uint8_t{7};
+  varint.end();
+  REQUIRE(buf.size() == 302);
+  REQUIRE(static_cast<uint8_t>(buf.data()[0]) == (0x80 | (300 & 0x7f)));
+  REQUIRE(buf.data()[1] == 300 >> 7);
+
+  buf.resize(0);
+  FrameBuilder small{buf, LengthPrefix::Varint, 1};
+  small << uint8_t{1};
+  small.begin();
+  small << std::string(200, 'z');
+  REQUIRE_THROWS_AS(small.end(), std::length_error);
+  REQUIRE(small.depth() == 1);
+  {
+    auto frame = small.frame();
+    small << "ok";
+  }
+  REQUIRE(buf.size() == 1 + 1 + 200 + 1 + 2);
+  {
+    auto frame = small.frame();
+    small << std::string(128, 'z');
+  }
+  REQUIRE(buf.size() == 1 + 1 + 200 + 1 + 2);
+  REQUIRE(small.depth() == 1);
+  REQUIRE_THROWS_AS(FrameBuilder(buf, LengthPrefix::Varint, 11), std::invalid_argument);
+}
+
+TEST_CASE("FrameBuilder keeps a frame scope that failed to end") {
+  FlexBuffer buf;
+  FrameBuilder builder{buf, LengthPrefix::Varint, 1};
+  builder << uint8_t{1};
+  {
+    auto frame = builder.frame();
+    builder << std::string(200, 'z');
+    REQUIRE_THROWS_AS(frame.end(), std::length_error);
+    REQUIRE(builder.depth() == 1);
+    REQUIRE(buf.size() == 1 + 1 + 200);
+  }
+  REQUIRE(builder.depth() == 0);
+  REQUIRE(buf.size() == 1);
+  {
+    auto frame = builder.frame();
+    builder << "ok";
+    frame.end();
+    REQUIRE_THROWS_AS(frame.end(), std::logic_error);
+  }
+  REQUIRE(builder.depth() == 0);
+  REQUIRE(buf.size() == 1 + 1 + 2);
+  REQUIRE(buf.data()[1] == 2);
+  REQUIRE(buf.span(2, 2).str() == "ok");
+}
+
+TEST_CASE("FrameBuilder drops frames unwound by an exception") {
+  FlexBuffer buf;
+  FrameBuilder builder{buf};
+  auto outer = builder.frame();
+  builder << "head";
+  try {
+    auto message = builder.frame();
+    builder << "partial";
+    auto nested = builder.frame(LengthPrefix::Varint);
+    builder << "body";
+    throw std::runtime_error{"serialization failed"};
+  } catch (const std::runtime_error&) {
+  }
+  REQUIRE(builder.depth() == 1);
+  REQUIRE(buf.size() == 8);
+  {
+    auto message = builder.frame(LengthPrefix::Uint16BE);
+    builder << "ok";
+  }
+  outer.end();
+  REQUIRE(buf.size() == 12);
+  REQUIRE(buf.read_be<uint32_t>(0) == 8);
+  REQUIRE(buf.read_be<uint16_t>(8) == 2);
+  REQUIRE(buf.span(10, 2).str() == "ok");
+
+  // a scope that begins and ends within unwinding, e.g. in a destructor, still patches its length
+  struct Cleanup {
+    FrameBuilder& builder;
+    ~Cleanup() {
+      auto frame = builder.frame(LengthPrefix::Uint16BE);
+      builder << "bye";
+    }
+  };
+  try {
+    Cleanup cleanup{builder};
+    throw std::runtime_error{"closing"};
+  } catch (const std::runtime_error&) {
+  }
+  REQUIRE(buf.size() == 17);
+  REQUIRE(buf.read_be<uint16_t>(12) == 3);
+  REQUIRE(buf.span(14, 3).str() == "bye");
+}
+
+TEST_CASE("FrameDecoder reassembles chunked frames") {
+  for (auto format : {LengthPrefix::Uint16BE, LengthPrefix::Uint16LE, LengthPrefix::Uint32BE, LengthPrefix::Uint32LE,
+                      LengthPrefix::Varint}) {
+    FlexBuffer stream;
+    FrameBuilder builder{stream, format, 2};
+    std::vector<std::string> messages{"hello", "", std::string(300, 'x'), "world"};
+    for (auto& message : messages) {
+      builder.begin();
+      builder << message;
+      builder.end();
+    }
+
+    FrameDecoder decoder{format};
+    std::vector<Buffer> frames;
+    for (size_t i = 0; i < stream.size(); i += 7) {
+      decoder << stream.span(i, std::min<size_t>(7, stream.size() - i));
+      while (auto frame = decoder.next())
+        frames.push_back(std::move(*frame));
+    }
+    REQUIRE(decoder.available() == 0);
+    REQUIRE(frames.size() == messages.size());
+    for (size_t i = 0; i < frames.size(); ++i)
+      REQUIRE(frames[i].str() == messages[i]);
+  }
+
+  FlexBuffer stream;
+  FlexBufferWriter writer{stream};
+  writer.write_be<uint32_t>(3) << "abc";
+  writer.write_be<uint32_t>(2) << "de";
+  writer.write_be<uint32_t>(4) << "f";
+  FrameDecoder decoder;
+  decoder << stream;
+  auto first = decoder.next();
+  auto second = decoder.next();
+  REQUIRE(first->str() == "abc");
+  REQUIRE(second->data() == first->data() + 7);
+  REQUIRE_FALSE(decoder.next());
+  REQUIRE(decoder.available() == 5);
+  decoder << "ghi";
+  auto third = decoder.next();
+  REQUIRE(third->str() == "fghi");
+  REQUIRE(first->str() == "abc");
+  REQUIRE(second->str() == "de");
+
+  FrameDecoder guarded{LengthPrefix::Uint16BE, 8};
+  guarded << std::string_view{"\x00\x09", 2};
+  REQUIRE_THROWS_AS(guarded.next(), std::length_error);
+  FrameDecoder malformed{LengthPrefix::Varint};
+  malformed << std::string(9, '\xff');
+  REQUIRE_FALSE(malformed.next());
+  malformed << std::string_view{"\xff"};
+  REQUIRE_THROWS_AS(malformed.next(), std::runtime_error);
+  FrameDecoder overflowing{LengthPrefix::Varint};
+  overflowing << std::string(9, '\x80') << std::string_view{"\x02"};
+  REQUIRE_THROWS_AS(overflowing.next(), std::runtime_error);
+  FrameDecoder top_bit{LengthPrefix::Varint};
+  top_bit << std::string(9, '\x80') << std::string_view{"\x01"};
+  REQUIRE_THROWS_AS(top_bit.next(), std::length_error);
+}
+
 TEST_CASE("FlexBuffer.data() const") {
   FlexBuffer buf;
   buf << "abc";